@@ -9,6 +9,7 @@ void Ball::tick(float delta)
 
 	transform.position.x += cos(22.5 * 3.14159 / 180) * rollSpeed * delta;
 	transform.position.z -= sin(22.5 * 3.14159 / 180) * rollSpeed * delta;
+	markTransformDirty();
 
 	Transform cameraTransform;
 	cameraTransform.position = transform.position;
@@ -0,0 +1,131 @@
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+
+#include "game_main.h"
+
+//Renders synthetic scenes headlessly and writes the averaged timings of each scene size as CSV and JSON.
+//Usage: VulkanSlopeBench [--sizes 1000,10000,100000] [--frames N] [--meshes N] [--textures N] [--seed N]
+//                        [--frames-in-flight N] [--csv path] [--json path]
+
+constexpr uint32_t BENCH_DEFAULT_FRAMES = 500;
+constexpr uint32_t BENCH_DEFAULT_MESHES = 16;
+constexpr uint32_t BENCH_DEFAULT_TEXTURES = 16;
+constexpr uint32_t BENCH_DEFAULT_SEED = 1;
+
+static std::vector<uint32_t> parseSizes(const char* list)
+{
+	std::vector<uint32_t> sizes;
+	std::stringstream stream(list);
+	std::string size;
+
+	while (std::getline(stream, size, ','))
+	{
+		if (atoi(size.c_str()) > 0)
+		{
+			sizes.push_back((uint32_t)atoi(size.c_str()));
+		}
+	}
+
+	return sizes;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint32_t> sizes = { 1000, 10000, 100000 };
+	uint32_t frames = BENCH_DEFAULT_FRAMES;
+	uint32_t uniqueMeshes = BENCH_DEFAULT_MESHES;
+	uint32_t uniqueTextures = BENCH_DEFAULT_TEXTURES;
+	uint32_t seed = BENCH_DEFAULT_SEED;
+	std::string csvPath = "bench_results.csv";
+	std::string jsonPath = "bench_results.json";
+
+	SlopeGame game = SlopeGame();
+	game.getRenderSettings().headless = true;
+
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--sizes") == 0)
+		{
+			sizes = parseSizes(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--frames") == 0)
+		{
+			frames = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--meshes") == 0)
+		{
+			uniqueMeshes = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--textures") == 0)
+		{
+			uniqueTextures = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--seed") == 0)
+		{
+			seed = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0)
+		{
+			game.getRenderSettings().framesInFlight = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--csv") == 0)
+		{
+			csvPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--json") == 0)
+		{
+			jsonPath = argv[++i];
+		}
+	}
+
+	game.init();
+	game.createSyntheticAssets(uniqueMeshes, uniqueTextures);
+
+	std::vector<ThroughputResult> results;
+
+	for (uint32_t size : sizes)
+	{
+		game.buildSyntheticScene(size, seed);
+		ThroughputResult result = game.benchmarkThroughput(frames);
+		results.push_back(result);
+
+		std::cout << size << " entities: " << result.frameTime << " ms/frame, " << result.framesPerSecond << " fps, record " << result.recordTime << " ms, submit "
+			<< result.submitTime << " ms, GPU " << result.gpuTime << " ms (p99 " << result.gpuTimeP99 << " ms)\n";
+	}
+
+	game.cleanup();
+
+	std::ofstream csv(csvPath, std::ios_base::trunc);
+	csv << "entities,unique_meshes,unique_textures,frames,visible_instances,frame_ms,fps,record_ms,submit_ms,gpu_ms,gpu_p99_ms\n";
+
+	for (ThroughputResult& result : results)
+	{
+		csv << result.entities << "," << uniqueMeshes << "," << uniqueTextures << "," << frames << "," << result.visibleInstances << "," << result.frameTime << ","
+			<< result.framesPerSecond << "," << result.recordTime << "," << result.submitTime << "," << result.gpuTime << "," << result.gpuTimeP99 << "\n";
+	}
+
+	std::ofstream json(jsonPath, std::ios_base::trunc);
+	json << "[\n";
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		ThroughputResult& result = results[i];
+
+		json << "  {\"entities\": " << result.entities << ", \"unique_meshes\": " << uniqueMeshes << ", \"unique_textures\": " << uniqueTextures << ", \"frames\": " << frames
+			<< ", \"visible_instances\": " << result.visibleInstances << ", \"frame_ms\": " << result.frameTime << ", \"fps\": " << result.framesPerSecond
+			<< ", \"record_ms\": " << result.recordTime << ", \"submit_ms\": " << result.submitTime << ", \"gpu_ms\": " << result.gpuTime << ", \"gpu_p99_ms\": " << result.gpuTimeP99 << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+
+	json << "]\n";
+
+	std::cout << "Wrote " << csvPath << " and " << jsonPath << "\n";
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "cpu_profiler.h"
+
+//Rings are created the first time a thread records and are never freed, so a trace can still be written after the thread has exited
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<ProfileRing>> rings;
+static thread_local ProfileRing* threadRing = nullptr;
+
+//Nanoseconds on the steady clock
+int64_t profileNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordProfileEvent(const char* name, int64_t start, int64_t end)
+{
+	if (!threadRing)
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		rings.push_back(std::make_unique<ProfileRing>());
+		threadRing = rings.back().get();
+		threadRing->threadId = rings.size() - 1;
+	}
+
+	//Only this thread writes to its ring, the release store publishes the event to a concurrent dump
+	uint64_t index = threadRing->written.load(std::memory_order_relaxed);
+	threadRing->events[index % PROFILE_RING_SIZE] = { name, start, end - start };
+	threadRing->written.store(index + 1, std::memory_order_release);
+}
+
+//Write every thread's recorded scopes as Chrome trace events, which both chrome://tracing and Perfetto open.
+//Can be called while other threads are recording. Anything they overwrote during the copy is left out.
+bool writeChromeTrace(const std::filesystem::path& filePath)
+{
+	std::vector<std::pair<uint32_t, ProfileEvent>> events;
+
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+
+		for (auto& ring : rings)
+		{
+			uint64_t end = ring->written.load(std::memory_order_acquire);
+			uint64_t begin = end > PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE : 0;
+			size_t firstEvent = events.size();
+
+			for (uint64_t i = begin; i < end; i++)
+			{
+				events.push_back({ ring->threadId, ring->events[i % PROFILE_RING_SIZE] });
+			}
+
+			//Drop the oldest events if the thread lapped them while they were being copied
+			uint64_t written = ring->written.load(std::memory_order_acquire);
+			uint64_t overwritten = written > PROFILE_RING_SIZE ? written - PROFILE_RING_SIZE : 0;
+
+			if (overwritten > begin)
+			{
+				events.erase(events.begin() + firstEvent, events.begin() + firstEvent + std::min(overwritten - begin, end - begin));
+			}
+		}
+	}
+
+	std::ofstream outputStream(filePath, std::ios_base::trunc);
+
+	if (!outputStream.is_open())
+	{
+		return false;
+	}
+
+	//Times are written in microseconds relative to the earliest event
+	int64_t origin = INT64_MAX;
+
+	for (auto& event : events)
+	{
+		origin = std::min(origin, event.second.start);
+	}
+
+	outputStream << "{\"traceEvents\":[\n";
+	outputStream.setf(std::ios_base::fixed);
+	outputStream.precision(3);
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const ProfileEvent& event = events[i].second;
+
+		outputStream << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].first
+			<< ",\"ts\":" << (event.start - origin) / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << "}"
+			<< (i + 1 < events.size() ? ",\n" : "\n");
+	}
+
+	outputStream << "]}\n";
+
+	return true;
+}
\ No newline at end of file
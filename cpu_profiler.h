@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <cstdint>
+
+//Scopes kept per thread, older ones are overwritten once the ring is full
+constexpr uint32_t PROFILE_RING_SIZE = 1 << 16;
+
+//A finished scope. Names must be string literals or otherwise outlive the profiler.
+struct ProfileEvent
+{
+	const char* name;
+	int64_t start;
+	int64_t duration;
+};
+
+//Written only by its own thread and read by whoever dumps a trace, so the write index is the only shared state
+struct ProfileRing
+{
+	ProfileEvent events[PROFILE_RING_SIZE];
+	std::atomic<uint64_t> written{ 0 };
+	uint32_t threadId;
+};
+
+int64_t profileNow();
+void recordProfileEvent(const char* name, int64_t start, int64_t end);
+bool writeChromeTrace(const std::filesystem::path& filePath);
+
+//Times the enclosing scope and records it to the calling thread's ring when it ends
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name) : name(name), start(profileNow())
+	{
+	}
+
+	~ProfileScope()
+	{
+		recordProfileEvent(name, start, profileNow());
+	}
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+//Compiled out entirely unless SLOPE_PROFILE is defined
+#ifdef SLOPE_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
\ No newline at end of file
@@ -9,4 +9,10 @@ struct Scene
 {
 	Transform cameraTransform;
 	std::vector<std::unique_ptr<Entity>> entities;
+
+	//Indices of entities whose instance data changed since the renderer last uploaded it
+	std::vector<uint32_t> dirtyEntities;
+
+	//Set when entities are added, removed or reordered so the renderer uploads every instance again
+	bool instancesStale = true;
 };
\ No newline at end of file
@@ -13,6 +13,18 @@ void Entity::tick(float delta)
 	
 }
 
+//Only the first change between uploads queues the entity, an entity the renderer has never uploaded is covered by its full upload
+void Entity::markTransformDirty()
+{
+	if (transformDirty)
+	{
+		return;
+	}
+
+	transformDirty = true;
+	game->getCurrentScene().dirtyEntities.push_back(instanceIndex);
+}
+
 void Entity::setCameraTransform(Transform transform)
 {
 	game->getCurrentScene().cameraTransform = transform;
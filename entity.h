@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
 
 #include "mesh.h"
 #include "math_utils.h"
@@ -16,6 +17,13 @@ public:
 	Transform transform;
 	MeshInstance mesh;
 	SlopeGame* game;
+
+	//Call after changing the transform or mesh so the renderer uploads this entity's instance again
+	void markTransformDirty();
+
+	//Position in the scene's entity list as of the renderer's last full upload, cleared of dirt by the renderer
+	uint32_t instanceIndex = UINT32_MAX;
+	bool transformDirty = true;
 protected:
 	void setCameraTransform(Transform transform);
 };
@@ -19,6 +19,7 @@
 #include "mesh.h"
 #include "entity.h"
 #include "entity_builder.h"
+#include "mesh_optimizer.h"
 
 using namespace rapidjson;
 
@@ -36,7 +37,7 @@ std::string readFile(std::filesystem::path filePath)
     return buffer.str();
 }
 
-std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadModel(std::filesystem::path filePath)
+std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadModel(std::filesystem::path filePath, bool reduceOverdraw)
 {
     fastgltf::GltfDataBuffer data;
     data.loadFromFile(filePath);
@@ -144,9 +145,38 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadModel(std::filesystem
             asset.surfaces.push_back(surface);
         }
 
+        //Reorder each surface's triangles for the post-transform cache, then the vertices for fetch locality.
+        //Triangles stay inside their own surface so the surface ranges remain valid.
+        VertexCacheStats before = analyzeVertexCache(indices, 0, (uint32_t)indices.size(), (uint32_t)vertices.size());
+
+        for (GeoSurface& surface : asset.surfaces)
+        {
+            std::vector<uint32_t> clusters = optimizeVertexCache(indices, surface.startIndex, surface.count, (uint32_t)vertices.size());
+
+            if (reduceOverdraw)
+            {
+                optimizeOverdraw(indices, surface.startIndex, surface.count, vertices, clusters);
+            }
+        }
+
         asset.mesh.vertices = vertices;
         asset.mesh.indices = indices;
 
+        //LODs are appended after the full detail indices, before the vertex reorder so it covers them too
+        generateLods(asset.mesh);
+        optimizeVertexFetch(asset.mesh.vertices, asset.mesh.indices);
+
+        VertexCacheStats after = analyzeVertexCache(asset.mesh.indices, 0, (uint32_t)indices.size(), (uint32_t)asset.mesh.vertices.size());
+
+        std::cout << filePath.filename().string() << " " << asset.name << ": ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+
+        for (uint32_t lod = 1; lod < asset.mesh.lods.size(); lod++)
+        {
+            std::cout << "  LOD " << lod << ": " << asset.mesh.lods[lod].indexCount / 3 << " triangles, error " << asset.mesh.lods[lod].error << "\n";
+        }
+
+        asset.mesh.computeBounds();
+
         meshes.emplace_back(std::make_shared<MeshAsset>(std::move(asset)));
     }
 
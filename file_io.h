@@ -32,6 +32,6 @@ struct TextureAsset
 };
 
 std::string readFile(std::filesystem::path filePath);
-std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadModel(std::filesystem::path filePath);
+std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadModel(std::filesystem::path filePath, bool reduceOverdraw = true);
 TextureAsset loadImage(std::filesystem::path filePath, std::string name);
 void loadScene(Scene& scene, std::filesystem::path filePath, std::unordered_map<std::string, MeshAsset>& assets, std::unordered_map<std::string, TextureImage>& textures);
\ No newline at end of file
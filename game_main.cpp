@@ -6,6 +6,8 @@
 #include <chrono>
 #include <algorithm>
 #include <filesystem>
+#include <cmath>
+#include <random>
 
 #include "game_main.h"
 #include "VkBootstrap.h"
@@ -14,6 +16,7 @@
 #include "file_io.h"
 #include "math_utils.h"
 #include "entity.h"
+#include "cpu_profiler.h"
 
 namespace fs = std::filesystem;
 
@@ -32,14 +35,22 @@ void SlopeGame::onResize(int width, int height)
 
 void SlopeGame::init()
 {
-	glfwInit();
+	auto startupStart = std::chrono::high_resolution_clock::now();
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-	window = glfwCreateWindow(width, height, "Slope", nullptr, nullptr);
-	glfwSetWindowUserPointer(window, this);
-	glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	//Headless runs never touch GLFW, so they work on machines without a display
+	bool headless = renderer.settings.headless;
+
+	if (!headless)
+	{
+		glfwInit();
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		window = glfwCreateWindow(width, height, "Slope", nullptr, nullptr);
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	}
 
 	inputHandler = { window };
 
@@ -55,6 +66,7 @@ void SlopeGame::init()
 		.request_validation_layers(validation)
 		.require_api_version(1, 3, 0)
 		.use_default_debug_messenger()
+		.set_headless(headless)
 		.build();
 
 	if (!instRet)
@@ -64,12 +76,12 @@ void SlopeGame::init()
 
 	vkbInstance = instRet.value();
 
-	if (glfwCreateWindowSurface(vkbInstance, window, nullptr, &surface) != VK_SUCCESS)
+	if (!headless && glfwCreateWindowSurface(vkbInstance, window, nullptr, &surface) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to create window surface!");
 	}
 
-	renderer.init(vkbInstance, &surface, width, height);
+	renderer.init(vkbInstance, headless ? nullptr : &surface, width, height);
 
 	loadAssets();
 
@@ -84,16 +96,21 @@ void SlopeGame::init()
 	mainScene.cameraTransform.position = glm::vec3(-8.0, 0.0, 0.0);
 
 	previousTime = std::chrono::high_resolution_clock::now();
+
+	std::cout << "Startup took " << std::chrono::duration<float, std::chrono::milliseconds::period>(previousTime - startupStart).count() << " ms\n";
 }
 
 void SlopeGame::loadAssets()
 {
+	PROFILE_SCOPE("Load assets");
+
 	//Load Models
 	for (const auto& entry : fs::directory_iterator("models"))
 	{
 		const auto path = entry.path();
 		if (entry.is_regular_file() && path.extension().string().compare("glb"))
 		{
+			PROFILE_SCOPE("Load model");
 			std::optional<std::vector<std::shared_ptr<MeshAsset>>> model = loadModel(path);
 			renderer.uploadMesh(model.value()[0].get()->mesh);
 			assets.insert({ path.filename().stem().string(), *model.value()[0].get() });
@@ -106,6 +123,7 @@ void SlopeGame::loadAssets()
 		const auto path = entry.path();
 		if (entry.is_regular_file() && path.extension().string().compare("png"))
 		{
+			PROFILE_SCOPE("Load texture");
 			const std::string name = path.filename().stem().string();
 			TextureAsset texture = loadImage(path, name);
 			textures.insert({ name, renderer.uploadTexture(texture.data, texture.width, texture.height) });
@@ -115,8 +133,22 @@ void SlopeGame::loadAssets()
 
 bool SlopeGame::tick()
 {
+	PROFILE_SCOPE("Tick");
+
 	inputHandler.update();
 
+#ifdef SLOPE_PROFILE
+	//Dump everything recorded so far when the trace key is pressed
+	bool tracePressed = inputHandler.readBind("trace");
+
+	if (tracePressed && !traceHeld)
+	{
+		std::cout << (writeChromeTrace(TRACE_PATH) ? "Wrote trace to " : "Failed to write trace to ") << TRACE_PATH << "\n";
+	}
+
+	traceHeld = tracePressed;
+#endif
+
 	while (width == 0 || height == 0)
 	{
 		glfwGetFramebufferSize(window, &width, &height);
@@ -129,9 +161,14 @@ bool SlopeGame::tick()
 
 	previousTime = currentTime;
 
-	for (auto& entity : mainScene.entities)
 	{
-		entity->tick(delta);
+		//One scope for all entities, a scope each would cost more than most entity ticks
+		PROFILE_SCOPE("Entity ticks");
+
+		for (auto& entity : mainScene.entities)
+		{
+			entity->tick(delta);
+		}
 	}
 
 	renderer.drawFrame(mainScene);
@@ -139,13 +176,319 @@ bool SlopeGame::tick()
 	return !glfwWindowShouldClose(window);
 }
 
+//Fill the scene with copies of its meshes and time draw recording against the number of recording threads
+void SlopeGame::benchmarkRecording(uint32_t instanceCount, uint32_t frames)
+{
+	std::vector<MeshInstance> meshes;
+
+	for (auto& entity : mainScene.entities)
+	{
+		if (entity->mesh.mesh)
+		{
+			meshes.push_back(entity->mesh);
+		}
+	}
+
+	if (meshes.empty())
+	{
+		std::cout << "No meshes in scene to benchmark\n";
+		return;
+	}
+
+	uint32_t gridSize = (uint32_t)std::ceil(std::cbrt((float)instanceCount));
+
+	for (uint32_t i = 0; i < instanceCount; i++)
+	{
+		std::unique_ptr<Entity> entity = std::make_unique<Entity>();
+		entity->mesh = meshes[i % meshes.size()];
+		entity->transform.position = glm::vec3(i % gridSize, (i / gridSize) % gridSize, i / (gridSize * gridSize)) * 3.0f;
+		entity->game = this;
+		mainScene.entities.push_back(std::move(entity));
+	}
+
+	//Direct drawing records one command per instance, which is the case parallel recording is for
+	renderer.settings.drawMode = DrawMode::Direct;
+	renderer.settings.cullMode = CullMode::None;
+
+	std::cout << "Recording " << mainScene.entities.size() << " draws x " << frames << " frames\n";
+
+	for (uint32_t threads = 1; threads <= MAX_RECORD_THREADS; threads *= 2)
+	{
+		renderer.settings.recordThreads = threads;
+
+		//Let the recording contexts and any outstanding uploads settle before measuring
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT * 2; i++)
+		{
+			renderer.drawFrame(mainScene);
+		}
+
+		float recordTime = 0.0f;
+
+		for (uint32_t i = 0; i < frames; i++)
+		{
+			if (!renderer.settings.headless)
+			{
+				glfwPollEvents();
+			}
+
+			renderer.drawFrame(mainScene);
+			recordTime += renderer.stats.recordTime;
+		}
+
+		std::cout << threads << " threads: " << recordTime / frames << " ms\n";
+	}
+}
+
+//Tile the distant field with copies of the ramp and compare GPU frame time with and without mipmaps.
+//Nearly every texel fetch out here is minified, so the difference is dominated by texture bandwidth.
+void SlopeGame::benchmarkMipmaps(uint32_t frames)
+{
+	MeshInstance ramp = {};
+
+	for (auto& entity : mainScene.entities)
+	{
+		if (entity->mesh.mesh && (!ramp.mesh || entity->name == "ramp"))
+		{
+			ramp = entity->mesh;
+		}
+	}
+
+	if (!ramp.mesh)
+	{
+		std::cout << "No meshes in scene to benchmark\n";
+		return;
+	}
+
+	for (int x = 0; x < 16; x++)
+	{
+		for (int y = -10; y <= 10; y++)
+		{
+			std::unique_ptr<Entity> entity = std::make_unique<Entity>();
+			entity->mesh = ramp;
+			entity->transform.position = glm::vec3(4.0f + x * 2.0f, y * 2.0f, -8.0f);
+			entity->game = this;
+			mainScene.entities.push_back(std::move(entity));
+		}
+	}
+
+	mainScene.cameraTransform.position = glm::vec3(-6.0f, 0.0f, 2.0f);
+
+	GpuScopeStats frameTimes[2] = {};
+
+	for (int mipmaps = 0; mipmaps < 2; mipmaps++)
+	{
+		renderer.settings.textureMipmaps = mipmaps;
+
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT * 2; i++)
+		{
+			renderer.drawFrame(mainScene);
+		}
+
+		//Timings arrive framesInFlight frames late, so history is cleared that many frames in and the loop runs that many past the measured frames
+		uint32_t latency = std::clamp(renderer.settings.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+		for (uint32_t i = 0; i < frames + latency; i++)
+		{
+			if (i == latency)
+			{
+				renderer.gpuProfiler.clearHistory();
+			}
+
+			if (!renderer.settings.headless)
+			{
+				glfwPollEvents();
+			}
+
+			renderer.drawFrame(mainScene);
+		}
+
+		for (GpuScopeStats& scope : renderer.gpuProfiler.getStats())
+		{
+			if (scope.name == "Frame")
+			{
+				frameTimes[mipmaps] = scope;
+			}
+		}
+	}
+
+	std::cout << "Far view, " << mainScene.entities.size() << " entities x " << frames << " frames\n";
+	std::cout << "Base level only: " << frameTimes[0].avg << " ms avg, " << frameTimes[0].p99 << " ms p99\n";
+	std::cout << "Mipmapped: " << frameTimes[1].avg << " ms avg, " << frameTimes[1].p99 << " ms p99 (" << (1.0f - frameTimes[1].avg / frameTimes[0].avg) * 100.0f << "% less)\n";
+}
+
+//Tick and render a fixed number of frames as fast as the device allows, for throughput and soak runs without a display.
+//Entities tick with a fixed step so every run simulates the same frames.
+void SlopeGame::runHeadless(uint32_t frames)
+{
+	std::cout << "Rendering " << frames << " headless frames at " << width << "x" << height << "\n";
+
+	auto runStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		PROFILE_SCOPE("Tick");
+
+		for (auto& entity : mainScene.entities)
+		{
+			entity->tick(HEADLESS_TICK_DELTA);
+		}
+
+		renderer.drawFrame(mainScene);
+	}
+
+	float runTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - runStart).count();
+
+	std::cout << "Rendered " << frames << " frames in " << runTime << " ms (" << runTime / frames << " ms per frame, " << frames * 1000.0f / runTime << " fps)\n";
+}
+
+//Upload the requested number of distinct meshes and textures, cycling through the files in models and textures
+void SlopeGame::createSyntheticAssets(uint32_t uniqueMeshes, uint32_t uniqueTextures)
+{
+	std::vector<Mesh*> sourceMeshes;
+	std::vector<fs::path> texturePaths;
+
+	for (auto& element : assets)
+	{
+		sourceMeshes.push_back(&element.second.mesh);
+	}
+
+	for (const auto& entry : fs::directory_iterator("textures"))
+	{
+		if (entry.is_regular_file() && entry.path().extension() == ".png")
+		{
+			texturePaths.push_back(entry.path());
+		}
+	}
+
+	if (sourceMeshes.empty() || texturePaths.empty())
+	{
+		throw std::runtime_error("Synthetic scenes need at least one model and one texture");
+	}
+
+	for (uint32_t i = 0; i < uniqueMeshes; i++)
+	{
+		syntheticMeshes.push_back(std::make_unique<Mesh>(*sourceMeshes[i % sourceMeshes.size()]));
+		renderer.uploadMesh(*syntheticMeshes.back());
+	}
+
+	for (uint32_t i = 0; i < uniqueTextures; i++)
+	{
+		const fs::path& path = texturePaths[i % texturePaths.size()];
+		TextureAsset texture = loadImage(path, path.stem().string());
+		syntheticTextures.push_back(std::make_unique<TextureImage>(renderer.uploadTexture(texture.data, texture.width, texture.height)));
+	}
+}
+
+//Replace the scene with a cube of entities picking their mesh and texture at random from the synthetic assets.
+//The camera looks into the cube from one side, so culling and LOD selection both have work to do.
+void SlopeGame::buildSyntheticScene(uint32_t entityCount, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<uint32_t> meshDistribution(0, syntheticMeshes.size() - 1);
+	std::uniform_int_distribution<uint32_t> textureDistribution(0, syntheticTextures.size() - 1);
+
+	mainScene.entities.clear();
+
+	uint32_t gridSize = (uint32_t)std::ceil(std::cbrt((float)entityCount));
+
+	for (uint32_t i = 0; i < entityCount; i++)
+	{
+		std::unique_ptr<Entity> entity = std::make_unique<Entity>();
+		entity->mesh.mesh = syntheticMeshes[meshDistribution(random)].get();
+		entity->mesh.texture = syntheticTextures[textureDistribution(random)].get();
+		entity->transform.position = glm::vec3(i % gridSize, (i / gridSize) % gridSize, i / (gridSize * gridSize)) * 3.0f;
+		entity->game = this;
+		mainScene.entities.push_back(std::move(entity));
+	}
+
+	mainScene.instancesStale = true;
+	mainScene.cameraTransform = Transform();
+	mainScene.cameraTransform.position = glm::vec3(-8.0f, gridSize * 1.5f, gridSize * 1.5f);
+}
+
+//Render the current scene for a number of frames once its uploads have landed and average the renderer's timings
+ThroughputResult SlopeGame::benchmarkThroughput(uint32_t frames)
+{
+	while (renderer.hasPendingUploads())
+	{
+		renderer.drawFrame(mainScene);
+	}
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT * 2; i++)
+	{
+		renderer.drawFrame(mainScene);
+	}
+
+	//GPU timings are read back when a frame's slot comes round again, framesInFlight frames later. History is cleared
+	//once the warm up frames' timings are in, and the loop runs on until the last measured frame's have arrived too.
+	//CPU timings only cover the measured frames.
+	uint32_t latency = std::clamp(renderer.settings.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+	ThroughputResult result = {};
+	result.entities = mainScene.entities.size();
+
+	auto runStart = std::chrono::high_resolution_clock::now();
+	float runTime = 0.0f;
+
+	for (uint32_t i = 0; i < frames + latency; i++)
+	{
+		if (i == latency)
+		{
+			renderer.gpuProfiler.clearHistory();
+		}
+
+		renderer.drawFrame(mainScene);
+
+		if (i < frames)
+		{
+			result.recordTime += renderer.stats.recordTime;
+			result.submitTime += renderer.stats.submitTime;
+			result.visibleInstances = renderer.stats.visibleInstances;
+		}
+
+		if (i + 1 == frames)
+		{
+			runTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - runStart).count();
+		}
+	}
+
+	result.frameTime = runTime / frames;
+	result.framesPerSecond = frames * 1000.0f / runTime;
+	result.recordTime /= frames;
+	result.submitTime /= frames;
+
+	for (GpuScopeStats& scope : renderer.gpuProfiler.getStats())
+	{
+		if (scope.name == "Frame")
+		{
+			result.gpuTime = scope.avg;
+			result.gpuTimeP99 = scope.p99;
+		}
+	}
+
+	return result;
+}
+
 Scene& SlopeGame::getCurrentScene()
 {
 	return mainScene;
 }
 
+RenderSettings& SlopeGame::getRenderSettings()
+{
+	return renderer.settings;
+}
+
 void SlopeGame::cleanup()
 {
+	//Report where the GPU spent its time over the last frames
+	std::cout << "GPU time (min / avg / p99 ms):\n";
+
+	for (GpuScopeStats& scope : renderer.gpuProfiler.getStats())
+	{
+		std::cout << "  " << scope.name << ": " << scope.min << " / " << scope.avg << " / " << scope.p99 << "\n";
+	}
+
 	for (auto& element : assets)
 	{
 		renderer.deleteMesh(element.second.mesh);
@@ -156,8 +499,24 @@ void SlopeGame::cleanup()
 		renderer.deleteTexture(element.second);
 	}
 
+	for (auto& mesh : syntheticMeshes)
+	{
+		renderer.deleteMesh(*mesh);
+	}
+
+	for (auto& texture : syntheticTextures)
+	{
+		renderer.deleteTexture(*texture);
+	}
+
 	renderer.cleanup();
 
+	if (renderer.settings.headless)
+	{
+		vkDestroyInstance(vkbInstance.instance, nullptr);
+		return;
+	}
+
 	vkDestroySurfaceKHR(vkbInstance.instance, surface, nullptr);
 	vkDestroyInstance(vkbInstance.instance, nullptr);
 
@@ -14,6 +14,23 @@
 #include "engine_types.h"
 #include "input.h"
 
+constexpr const char* TRACE_PATH = "trace.json";
+constexpr float HEADLESS_TICK_DELTA = 1.0f / 60.0f;
+constexpr uint32_t HEADLESS_DEFAULT_FRAMES = 1000;
+
+//Averages over the measured frames of one throughput run, times in milliseconds
+struct ThroughputResult
+{
+	uint32_t entities;
+	uint32_t visibleInstances;
+	float frameTime;
+	float framesPerSecond;
+	float recordTime;
+	float submitTime;
+	float gpuTime;
+	float gpuTimeP99;
+};
+
 class SlopeGame
 {
 public:
@@ -21,11 +38,18 @@ public:
 	void init();
 	bool tick();
 	void cleanup();
+	void benchmarkRecording(uint32_t instanceCount, uint32_t frames);
+	void benchmarkMipmaps(uint32_t frames);
+	void runHeadless(uint32_t frames);
+	void createSyntheticAssets(uint32_t uniqueMeshes, uint32_t uniqueTextures);
+	void buildSyntheticScene(uint32_t entityCount, uint32_t seed);
+	ThroughputResult benchmarkThroughput(uint32_t frames);
 	Scene& getCurrentScene();
+	RenderSettings& getRenderSettings();
 
 	InputHandler inputHandler = { nullptr };
 private:
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
 	vkb::Instance vkbInstance;
 	VkSurfaceKHR surface;
 
@@ -38,10 +62,15 @@ private:
 	std::unordered_map<std::string, TextureImage> textures;
 	Scene mainScene;
 
+	//Copies of the loaded assets, each uploaded separately so they count as distinct meshes and textures
+	std::vector<std::unique_ptr<Mesh>> syntheticMeshes;
+	std::vector<std::unique_ptr<TextureImage>> syntheticTextures;
+
 	int width = 960;
 	int height = 540;
 
 	double mouseX = 0, mouseY = 0;
+	bool traceHeld = false;
 
 	std::chrono::steady_clock::time_point currentTime;
 	std::chrono::steady_clock::time_point previousTime;
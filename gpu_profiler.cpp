@@ -0,0 +1,158 @@
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "gpu_profiler.h"
+
+void GpuProfiler::init(VkDevice device, float timestampPeriod)
+{
+	this->device = device;
+	this->timestampPeriod = timestampPeriod;
+}
+
+void GpuProfiler::createFrame(GpuTimestampFrame& frame)
+{
+	VkQueryPoolCreateInfo queryPoolInfo = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = MAX_GPU_SCOPES * 2;
+
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.queryPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create query pool");
+	}
+
+	frame.scopes.reserve(MAX_GPU_SCOPES);
+}
+
+void GpuProfiler::destroyFrame(GpuTimestampFrame& frame)
+{
+	vkDestroyQueryPool(device, frame.queryPool, nullptr);
+}
+
+//Collect the timings this slot recorded last time round, then reset its queries for the new frame.
+//Must be called outside of rendering, and only once the slot's previous submission has finished.
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, GpuTimestampFrame& frame)
+{
+	uint32_t queryCount = frame.scopes.size() * 2;
+
+	if (queryCount > 0)
+	{
+		uint64_t timestamps[MAX_GPU_SCOPES * 2];
+
+		if (vkGetQueryPoolResults(device, frame.queryPool, 0, queryCount, sizeof(uint64_t) * queryCount, timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			for (uint32_t i = 0; i < frame.scopes.size(); i++)
+			{
+				ScopeHistory& scope = findHistory(frame.scopes[i]);
+				float time = (timestamps[i * 2 + 1] - timestamps[i * 2]) * timestampPeriod / 1000000.0f;
+
+				if (scope.samples.size() < GPU_PROFILER_HISTORY)
+				{
+					scope.samples.push_back(time);
+				}
+				else
+				{
+					scope.samples[scope.next] = time;
+				}
+
+				scope.next = (scope.next + 1) % GPU_PROFILER_HISTORY;
+				scope.last = time;
+			}
+		}
+	}
+
+	frame.scopes.clear();
+	vkCmdResetQueryPool(commandBuffer, frame.queryPool, 0, MAX_GPU_SCOPES * 2);
+
+	this->commandBuffer = commandBuffer;
+	this->frame = &frame;
+}
+
+//Both timestamps wait for all earlier commands, so a scope covers exactly the work recorded inside it.
+//Scopes past MAX_GPU_SCOPES in a frame are dropped.
+uint32_t GpuProfiler::beginScope(const char* name)
+{
+	if (frame->scopes.size() == MAX_GPU_SCOPES)
+	{
+		return UINT32_MAX;
+	}
+
+	uint32_t scope = frame->scopes.size();
+	frame->scopes.push_back(name);
+
+	vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame->queryPool, scope * 2);
+
+	return scope;
+}
+
+void GpuProfiler::endScope(uint32_t scope)
+{
+	if (scope != UINT32_MAX)
+	{
+		vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame->queryPool, scope * 2 + 1);
+	}
+}
+
+//Forget every sample taken so far, so a benchmark only measures the settings it is running with
+void GpuProfiler::clearHistory()
+{
+	for (ScopeHistory& scope : history)
+	{
+		scope.samples.clear();
+		scope.next = 0;
+	}
+}
+
+//Scopes are listed in the order they were first seen, which is the order the frame records them
+std::vector<GpuScopeStats> GpuProfiler::getStats()
+{
+	std::vector<GpuScopeStats> stats;
+	std::vector<float> sorted;
+
+	for (ScopeHistory& scope : history)
+	{
+		if (scope.samples.empty())
+		{
+			continue;
+		}
+
+		sorted = scope.samples;
+		std::sort(sorted.begin(), sorted.end());
+
+		float total = 0.0f;
+
+		for (float sample : sorted)
+		{
+			total += sample;
+		}
+
+		GpuScopeStats scopeStats;
+		scopeStats.name = scope.name;
+		scopeStats.last = scope.last;
+		scopeStats.min = sorted.front();
+		scopeStats.avg = total / sorted.size();
+		scopeStats.p99 = sorted[(sorted.size() * 99 + 99) / 100 - 1];
+		scopeStats.samples = sorted.size();
+		stats.push_back(scopeStats);
+	}
+
+	return stats;
+}
+
+//Scope names are compared by content since the same literal may have different addresses in different translation units
+GpuProfiler::ScopeHistory& GpuProfiler::findHistory(const char* name)
+{
+	for (ScopeHistory& scope : history)
+	{
+		if (strcmp(scope.name.c_str(), name) == 0)
+		{
+			return scope;
+		}
+	}
+
+	history.push_back({ name });
+	history.back().samples.reserve(GPU_PROFILER_HISTORY);
+
+	return history.back();
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//Each scope takes a begin and end timestamp, so a frame can hold half as many scopes as the pool has queries
+constexpr uint32_t MAX_GPU_SCOPES = 32;
+
+//Samples kept per scope for the rolling statistics
+constexpr uint32_t GPU_PROFILER_HISTORY = 256;
+
+//One frame slot's timestamp queries. They are read back the next time the slot comes round,
+//after the frame timeline has shown the GPU is done with it, so the CPU never waits on a result.
+struct GpuTimestampFrame
+{
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	std::vector<const char*> scopes;
+};
+
+//Rolling timings of one scope in milliseconds
+struct GpuScopeStats
+{
+	std::string name;
+	float last;
+	float min;
+	float avg;
+	float p99;
+	uint32_t samples;
+};
+
+//Times named scopes of command buffer work with timestamp queries and keeps recent history for each
+class GpuProfiler
+{
+public:
+	void init(VkDevice device, float timestampPeriod);
+	void createFrame(GpuTimestampFrame& frame);
+	void destroyFrame(GpuTimestampFrame& frame);
+
+	void beginFrame(VkCommandBuffer commandBuffer, GpuTimestampFrame& frame);
+	uint32_t beginScope(const char* name);
+	void endScope(uint32_t scope);
+	void clearHistory();
+
+	std::vector<GpuScopeStats> getStats();
+
+private:
+	struct ScopeHistory
+	{
+		std::string name;
+		std::vector<float> samples;
+		uint32_t next = 0;
+		float last = 0.0f;
+	};
+
+	VkDevice device;
+	float timestampPeriod;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	GpuTimestampFrame* frame = nullptr;
+	std::vector<ScopeHistory> history;
+
+	ScopeHistory& findHistory(const char* name);
+};
+
+//Begins a scope on construction and ends it when it goes out of scope
+class GpuScope
+{
+public:
+	GpuScope(GpuProfiler& profiler, const char* name) : profiler(profiler), scope(profiler.beginScope(name))
+	{
+	}
+
+	~GpuScope()
+	{
+		profiler.endScope(scope);
+	}
+
+private:
+	GpuProfiler& profiler;
+	uint32_t scope;
+};
\ No newline at end of file
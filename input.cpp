@@ -9,7 +9,8 @@ InputHandler::InputHandler(GLFWwindow* window)
 		{"forward", GLFW_KEY_W},
 		{"backward", GLFW_KEY_S},
 		{"left", GLFW_KEY_A},
-		{"right", GLFW_KEY_D}
+		{"right", GLFW_KEY_D},
+		{"trace", GLFW_KEY_F9}
 	};
 
 	this->window = window;
@@ -21,11 +22,17 @@ InputHandler::InputHandler(GLFWwindow* window)
 
 bool InputHandler::readBind(std::string bind)
 {
-	return glfwGetKey(window, keybinds[bind]);
+	//Headless runs have no window and never see input
+	return window && glfwGetKey(window, keybinds[bind]);
 }
 
 void InputHandler::update()
 {
+	if (!window)
+	{
+		return;
+	}
+
 	glfwPollEvents();
 
 	mouseX1 = mouseX2;
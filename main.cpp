@@ -1,8 +1,68 @@
+#include <cstring>
+
 #include "game_main.h"
-int main()
+#include "render_cull.h"
+
+int main(int argc, char** argv)
 {
+	uint32_t headlessFrames = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--bench-cull") == 0)
+	{
+		benchmarkCulling(100000, 100);
+		return 0;
+	}
+
 	SlopeGame game = SlopeGame();
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--packed-vertices") == 0)
+		{
+			game.getRenderSettings().packedVertices = true;
+		}
+
+		if (strcmp(argv[i], "--cold-start") == 0)
+		{
+			game.getRenderSettings().pipelineCache = false;
+		}
+
+		if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			game.getRenderSettings().framesInFlight = (uint32_t)atoi(argv[++i]);
+		}
+
+		//Render offscreen without a window, for the given number of frames when not benchmarking
+		if (strcmp(argv[i], "--headless") == 0)
+		{
+			game.getRenderSettings().headless = true;
+			headlessFrames = i + 1 < argc && atoi(argv[i + 1]) > 0 ? (uint32_t)atoi(argv[++i]) : HEADLESS_DEFAULT_FRAMES;
+		}
+	}
+
 	game.init();
+
+	if (argc > 1 && strcmp(argv[1], "--bench-record") == 0)
+	{
+		game.benchmarkRecording(60000, 200);
+		game.cleanup();
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "--bench-mips") == 0)
+	{
+		game.benchmarkMipmaps(300);
+		game.cleanup();
+		return 0;
+	}
+
+	if (headlessFrames)
+	{
+		game.runHeadless(headlessFrames);
+		game.cleanup();
+		return 0;
+	}
+
 	while (game.tick());
 	game.cleanup();
 	return 0;
@@ -26,4 +26,22 @@ glm::quat quatFromEulerAngles(glm::vec3 angles)
 	glm::quat aroundZ = glm::angleAxis(glm::radians(angles.y), glm::vec3(0.0, 0.0, 1.0));
 
 	return aroundY * aroundZ * aroundX;
+}
+
+//Extract the normalized left, right, bottom, top, near and far planes from a view projection matrix
+void extractFrustumPlanes(glm::mat4 viewProjection, glm::vec4 planes[6])
+{
+	glm::mat4 m = glm::transpose(viewProjection);
+
+	planes[0] = m[3] + m[0];
+	planes[1] = m[3] - m[0];
+	planes[2] = m[3] + m[1];
+	planes[3] = m[3] - m[1];
+	planes[4] = m[2];
+	planes[5] = m[3] - m[2];
+
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
 }
\ No newline at end of file
@@ -14,4 +14,5 @@ struct Transform
 	glm::vec3 getForwardVector();
 };
 
-glm::quat quatFromEulerAngles(glm::vec3 angles);
\ No newline at end of file
+glm::quat quatFromEulerAngles(glm::vec3 angles);
+void extractFrustumPlanes(glm::mat4 viewProjection, glm::vec4 planes[6]);
\ No newline at end of file
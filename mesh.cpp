@@ -1,49 +1,96 @@
-#include <iostream>
 #include "mesh.h"
-#include "vk_mem_alloc.h"
-#include "render_types.h"
-
-#define VK_CHECK(x)                                                 \
-	do                                                              \
-	{                                                               \
-		VkResult err = x;                                           \
-		if (err)                                                    \
-		{                                                           \
-			std::cout <<"Detected Vulkan error: " << err << std::endl; \
-			abort();                                                \
-		}                                                           \
-	} while (0)
-
-void Mesh::upload(VmaAllocator allocator)
+
+//Compute the bounding box of the vertices and fit a sphere around them, centered on the box
+void Mesh::computeBounds()
 {
-	VkBufferCreateInfo vertexBufferInfo = {};
-	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferInfo.size = vertices.size() * sizeof(Vertex);
-	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	glm::vec3 minPos = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+	glm::vec3 maxPos = minPos;
+
+	for (Vertex& vertex : vertices)
+	{
+		minPos = glm::min(minPos, vertex.pos);
+		maxPos = glm::max(maxPos, vertex.pos);
+	}
+
+	glm::vec3 center = (minPos + maxPos) * 0.5f;
+	float radius = 0.0f;
+
+	for (Vertex& vertex : vertices)
+	{
+		radius = glm::max(radius, glm::distance(center, vertex.pos));
+	}
 
-	VmaAllocationCreateInfo vmaAllocInfo = {};
-	vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	bounds.aabbMin = minPos;
+	bounds.aabbMax = maxPos;
+	bounds.sphere = glm::vec4(center, radius);
+}
 
-	VK_CHECK(vmaCreateBuffer(allocator, &vertexBufferInfo, &vmaAllocInfo, &vertexBuffer.buffer, &vertexBuffer.allocation, nullptr));
+//Longest side of the bounding box. Every axis is quantized over the same span so the dequantize transform is a uniform scale and leaves normals pointing the right way.
+static float getQuantizeScale(const MeshBounds& bounds)
+{
+	glm::vec3 extent = bounds.aabbMax - bounds.aabbMin;
+	float scale = glm::max(extent.x, glm::max(extent.y, extent.z));
+
+	return scale > 0.0f ? scale : 1.0f;
+}
 
-	void* vertexData;
-	vmaMapMemory(allocator, vertexBuffer.allocation, &vertexData);
+//Map a unit normal onto the octahedron and unfold the lower half over the upper one
+static glm::vec2 encodeOctahedral(glm::vec3 normal)
+{
+	normal /= glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+	glm::vec2 encoded = glm::vec2(normal.x, normal.y);
 
-	memcpy(vertexData, vertices.data(), vertices.size() * sizeof(Vertex));
+	if (normal.z < 0.0f)
+	{
+		glm::vec2 sign = glm::vec2(normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f);
+		encoded = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) * sign;
+	}
 
-	vmaUnmapMemory(allocator, vertexBuffer.allocation);
+	return encoded;
+}
 
-	VkBufferCreateInfo indexBufferInfo = {};
-	indexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	indexBufferInfo.size = indices.size() * sizeof(uint32_t);
-	indexBufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+//Convert the vertices to the packed layout. Bounds must be computed first.
+std::vector<PackedVertex> Mesh::packVertices()
+{
+	std::vector<PackedVertex> packed(vertices.size());
+	float scale = getQuantizeScale(bounds);
 
-	VK_CHECK(vmaCreateBuffer(allocator, &indexBufferInfo, &vmaAllocInfo, &indexBuffer.buffer, &indexBuffer.allocation, nullptr));
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		Vertex& vertex = vertices[i];
+		glm::vec3 position = (vertex.pos - bounds.aabbMin) / scale;
+		glm::vec2 normal = glm::length(vertex.normal) > 0.0f ? encodeOctahedral(glm::normalize(vertex.normal)) : glm::vec2(0.0f);
 
-	void* indexData;
-	vmaMapMemory(allocator, indexBuffer.allocation, &indexData);
+		packed[i].pos[0] = glm::packUnorm1x16(position.x);
+		packed[i].pos[1] = glm::packUnorm1x16(position.y);
+		packed[i].pos[2] = glm::packUnorm1x16(position.z);
+		packed[i].pos[3] = 0;
 
-	memcpy(indexData, indices.data(), indices.size() * sizeof(uint32_t));
+		packed[i].color[0] = glm::packUnorm1x8(vertex.color.r);
+		packed[i].color[1] = glm::packUnorm1x8(vertex.color.g);
+		packed[i].color[2] = glm::packUnorm1x8(vertex.color.b);
+		packed[i].color[3] = 255;
+
+		packed[i].texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+		packed[i].texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+
+		packed[i].normal[0] = (int16_t)glm::packSnorm1x16(normal.x);
+		packed[i].normal[1] = (int16_t)glm::packSnorm1x16(normal.y);
+	}
+
+	return packed;
+}
+
+//Packed positions go back to mesh space by scaling by this and offsetting by the bounds minimum, folded into each instance's transform
+float Mesh::getDequantizeScale()
+{
+	return getQuantizeScale(bounds);
+}
+
+//The bounding sphere in packed position space, for culling against instance transforms that include the dequantize transform
+glm::vec4 Mesh::getQuantizedSphere()
+{
+	float scale = getQuantizeScale(bounds);
 
-	vmaUnmapMemory(allocator, indexBuffer.allocation);
+	return glm::vec4((glm::vec3(bounds.sphere) - bounds.aabbMin) / scale, bounds.sphere.w / scale);
 }
\ No newline at end of file
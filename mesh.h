@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #include <vector>
 #include <optional>
 #include <array>
@@ -12,6 +13,16 @@
 #include "render_types.h"
 #include "math_utils.h"
 
+//Compact vertex layout used when the renderer is started with packed vertices, 20 bytes against 44.
+//Positions are 16 bit normalized values inside the mesh bounds, normals are octahedral encoded.
+struct PackedVertex
+{
+    uint16_t pos[4];
+    uint8_t color[4];
+    uint16_t texCoord[2];
+    int16_t normal[2];
+};
+
 struct Vertex
 {
     glm::vec3 pos;
@@ -19,34 +30,34 @@ struct Vertex
     glm::vec2 texCoord;
     glm::vec3 normal;
 
-    static VertexInputDescription getInputDescription()
+    static VertexInputDescription getInputDescription(bool packed = false)
     {
         VkVertexInputBindingDescription bindingDescription{};
         bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
+        bindingDescription.stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
         bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
         std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
 
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+        attributeDescriptions[0].format = packed ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[0].offset = packed ? offsetof(PackedVertex, pos) : offsetof(Vertex, pos);
 
         attributeDescriptions[1].binding = 0;
         attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
+        attributeDescriptions[1].format = packed ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[1].offset = packed ? offsetof(PackedVertex, color) : offsetof(Vertex, color);
 
         attributeDescriptions[2].binding = 0;
         attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+        attributeDescriptions[2].format = packed ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[2].offset = packed ? offsetof(PackedVertex, texCoord) : offsetof(Vertex, texCoord);
 
         attributeDescriptions[3].binding = 0;
         attributeDescriptions[3].location = 3;
-        attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[3].offset = offsetof(Vertex, normal);
+        attributeDescriptions[3].format = packed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[3].offset = packed ? offsetof(PackedVertex, normal) : offsetof(Vertex, normal);
 
         VertexInputDescription inputDescription;
         inputDescription.bindingDescription = bindingDescription;
@@ -56,14 +67,54 @@ struct Vertex
     }
 };
 
+struct MeshBounds
+{
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    glm::vec4 sphere;
+};
+
+//Most detail levels a mesh carries, the full detail mesh included
+constexpr uint32_t MAX_MESH_LODS = 5;
+
+//One detail level, a range of the mesh's index buffer drawn over the shared vertices.
+//Error is the largest distance the simplified surface moved from the original, in mesh units.
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
 struct Mesh
 {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
-    AllocatedBuffer vertexBuffer;
-    AllocatedBuffer indexBuffer;
+    std::vector<MeshLod> lods;
+    uint32_t geometry;
+    MeshBounds bounds;
 
-    void upload(VmaAllocator allocator);
+    void computeBounds();
+    std::vector<PackedVertex> packVertices();
+    float getDequantizeScale();
+    glm::vec4 getQuantizedSphere();
+
+    //16 bit indices can address every vertex
+    bool hasShortIndices()
+    {
+        return vertices.size() <= 65536;
+    }
+
+    //Meshes built without LODs draw all of their indices at every level
+    uint32_t getLodCount()
+    {
+        return lods.empty() ? 1 : (uint32_t)lods.size();
+    }
+
+    MeshLod getLod(uint32_t lod)
+    {
+        return lods.empty() ? MeshLod{ 0, (uint32_t)indices.size(), 0.0f } : lods[lod];
+    }
 };
 
 struct MeshInstance
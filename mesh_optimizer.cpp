@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+#include <unordered_map>
+#include <map>
+#include <queue>
+#include <tuple>
+
+#include "mesh_optimizer.h"
+
+//Simulate a FIFO cache over a range of the index buffer. A vertex is still cached while fewer than cacheSize misses have happened since it was loaded.
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t vertexCount, uint32_t cacheSize)
+{
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	std::unordered_set<uint32_t> unique;
+	uint32_t misses = 0;
+
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		uint32_t vertex = indices[i];
+		unique.insert(vertex);
+
+		if (misses + cacheSize + 1 - loadedAt[vertex] > cacheSize)
+		{
+			misses++;
+			loadedAt[vertex] = misses + cacheSize;
+		}
+	}
+
+	VertexCacheStats stats = {};
+	stats.acmr = count >= 3 ? misses / (float)(count / 3) : 0.0f;
+	stats.atvr = unique.empty() ? 0.0f : misses / (float)unique.size();
+
+	return stats;
+}
+
+//Next fanning vertex once the current one runs out of candidates: the most recently emitted vertex with triangles left, then the next one in input order
+static int64_t skipDeadEnd(std::vector<uint32_t>& deadEnd, const std::vector<uint32_t>& liveTriangles, const uint32_t* source, uint32_t count, uint32_t& cursor)
+{
+	while (!deadEnd.empty())
+	{
+		uint32_t vertex = deadEnd.back();
+		deadEnd.pop_back();
+
+		if (liveTriangles[vertex] > 0)
+		{
+			return vertex;
+		}
+	}
+
+	while (cursor < count)
+	{
+		uint32_t vertex = source[cursor++];
+
+		if (liveTriangles[vertex] > 0)
+		{
+			return vertex;
+		}
+	}
+
+	return -1;
+}
+
+//Reorder the triangles of a range of the index buffer with Tipsify (Sander, Nehab and Barczak 2007).
+//Triangles are emitted as fans around one vertex at a time, moving on to the neighbour that will still be cached once its remaining triangles are drawn.
+//Returns the first triangle of every cluster, the points where the walk had to jump elsewhere in the mesh, for use by optimizeOverdraw.
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t vertexCount, uint32_t cacheSize)
+{
+	std::vector<uint32_t> clusters;
+
+	if (count < 3)
+	{
+		return clusters;
+	}
+
+	const uint32_t* source = &indices[first];
+	uint32_t triangleCount = count / 3;
+
+	//Triangles using each vertex, stored back to back
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		liveTriangles[source[i]]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	std::partial_sum(liveTriangles.begin(), liveTriangles.end(), adjacencyOffsets.begin() + 1);
+
+	std::vector<uint32_t> adjacency(count);
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		adjacency[fill[source[i]]++] = i / 3;
+	}
+
+	std::vector<uint32_t> cachedAt(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(count);
+
+	uint32_t time = cacheSize + 1;
+	uint32_t cursor = 0;
+	int64_t fanning = source[0];
+
+	clusters.push_back(0);
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+		{
+			uint32_t triangle = adjacency[a];
+
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t vertex = source[triangle * 3 + k];
+
+				output.push_back(vertex);
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (time - cachedAt[vertex] > cacheSize)
+				{
+					cachedAt[vertex] = time;
+					time++;
+				}
+			}
+
+			emitted[triangle] = true;
+		}
+
+		//Prefer the oldest candidate that stays in the cache while its remaining triangles are emitted
+		int64_t next = -1;
+		int64_t bestPriority = -1;
+
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+
+			int64_t priority = 0;
+
+			if (time - cachedAt[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+			{
+				priority = time - cachedAt[vertex];
+			}
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = vertex;
+			}
+		}
+
+		if (next < 0)
+		{
+			next = skipDeadEnd(deadEnd, liveTriangles, source, count, cursor);
+
+			if (next >= 0)
+			{
+				clusters.push_back((uint32_t)(output.size() / 3));
+			}
+		}
+
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices.begin() + first);
+
+	return clusters;
+}
+
+//Draw the clusters found by optimizeVertexCache from the outside of the mesh inwards, so front faces tend to land before the surfaces they hide.
+//Each cluster is scored by how far its centre lies along its average normal, measured from the centre of the whole range.
+void optimizeOverdraw(std::vector<uint32_t>& indices, uint32_t first, uint32_t count, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters)
+{
+	uint32_t triangleCount = count / 3;
+
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	std::vector<glm::vec3> clusterCenters(clusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+	std::vector<float> clusterAreas(clusters.size(), 0.0f);
+	glm::vec3 meshCenter = glm::vec3(0.0f);
+	float meshArea = 0.0f;
+
+	for (uint32_t c = 0; c < clusters.size(); c++)
+	{
+		uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		for (uint32_t t = clusters[c]; t < end; t++)
+		{
+			glm::vec3 a = vertices[indices[first + t * 3]].pos;
+			glm::vec3 b = vertices[indices[first + t * 3 + 1]].pos;
+			glm::vec3 d = vertices[indices[first + t * 3 + 2]].pos;
+
+			glm::vec3 normal = glm::cross(b - a, d - a);
+			float area = glm::length(normal) * 0.5f;
+			glm::vec3 center = (a + b + d) / 3.0f;
+
+			clusterCenters[c] += center * area;
+			clusterNormals[c] += normal;
+			clusterAreas[c] += area;
+		}
+
+		meshCenter += clusterCenters[c];
+		meshArea += clusterAreas[c];
+	}
+
+	meshCenter = meshArea > 0.0f ? meshCenter / meshArea : meshCenter;
+
+	std::vector<float> scores(clusters.size(), 0.0f);
+
+	for (uint32_t c = 0; c < clusters.size(); c++)
+	{
+		if (clusterAreas[c] > 0.0f && glm::length(clusterNormals[c]) > 0.0f)
+		{
+			scores[c] = glm::dot(clusterCenters[c] / clusterAreas[c] - meshCenter, glm::normalize(clusterNormals[c]));
+		}
+	}
+
+	std::vector<uint32_t> order(clusters.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+		{
+			return scores[a] > scores[b];
+		});
+
+	std::vector<uint32_t> output;
+	output.reserve(count);
+
+	for (uint32_t c : order)
+	{
+		uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		output.insert(output.end(), indices.begin() + first + clusters[c] * 3, indices.begin() + first + end * 3);
+	}
+
+	std::copy(output.begin(), output.end(), indices.begin() + first);
+}
+
+//Renumber vertices in the order the index buffer first uses them, so vertex fetches walk memory forwards.
+//Vertices no index refers to are dropped.
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t)ordered.size();
+			ordered.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices = std::move(ordered);
+}
+
+//Symmetric 4x4 error quadric, stored as its upper triangle
+struct Quadric
+{
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+};
+
+//Squared distance to the plane through the point with the given unit normal
+static Quadric makePlaneQuadric(glm::dvec3 normal, glm::dvec3 point)
+{
+	double d = -glm::dot(normal, point);
+
+	return { normal.x * normal.x, normal.x * normal.y, normal.x * normal.z, normal.x * d,
+		normal.y * normal.y, normal.y * normal.z, normal.y * d,
+		normal.z * normal.z, normal.z * d,
+		d * d };
+}
+
+static void addQuadric(Quadric& quadric, const Quadric& other)
+{
+	quadric.a00 += other.a00;
+	quadric.a01 += other.a01;
+	quadric.a02 += other.a02;
+	quadric.a03 += other.a03;
+	quadric.a11 += other.a11;
+	quadric.a12 += other.a12;
+	quadric.a13 += other.a13;
+	quadric.a22 += other.a22;
+	quadric.a23 += other.a23;
+	quadric.a33 += other.a33;
+}
+
+static double evaluateQuadric(const Quadric& quadric, glm::dvec3 p)
+{
+	return quadric.a00 * p.x * p.x + quadric.a11 * p.y * p.y + quadric.a22 * p.z * p.z
+		+ 2.0 * (quadric.a01 * p.x * p.y + quadric.a02 * p.x * p.z + quadric.a12 * p.y * p.z)
+		+ 2.0 * (quadric.a03 * p.x + quadric.a13 * p.y + quadric.a23 * p.z)
+		+ quadric.a33;
+}
+
+//Moving one vertex onto another, versions catch entries made stale by later collapses
+struct EdgeCollapse
+{
+	double cost;
+	uint32_t from;
+	uint32_t to;
+	uint32_t fromVersion;
+	uint32_t toVersion;
+
+	bool operator>(const EdgeCollapse& other) const
+	{
+		return cost > other.cost;
+	}
+};
+
+//Reduce a range of the index buffer towards targetCount indices by collapsing edges in order of quadric error (Garland and Heckbert 1997).
+//Collapses move a vertex onto one of its neighbours rather than creating new vertices, so the result reuses the original vertex buffer.
+//Vertices on open borders or on attribute seams never move, keeping silhouettes and texture seams closed.
+//Error receives the square root of the largest quadric error accepted, roughly how far the surface moved.
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t targetCount, float& error)
+{
+	uint32_t vertexCount = (uint32_t)vertices.size();
+	uint32_t triangleCount = count / 3;
+	std::vector<uint32_t> triangles(indices.begin() + first, indices.begin() + first + triangleCount * 3);
+
+	//Vertices split along seams share a position, topology is built on positions so seams are not mistaken for open borders
+	std::vector<uint32_t> position(vertexCount);
+	std::vector<uint32_t> wedges(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	std::map<std::tuple<float, float, float>, uint32_t> positions;
+
+	for (uint32_t index : triangles)
+	{
+		referenced[index] = true;
+	}
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (referenced[v])
+		{
+			glm::vec3 pos = vertices[v].pos;
+			position[v] = positions.try_emplace({ pos.x, pos.y, pos.z }, v).first->second;
+			wedges[position[v]]++;
+		}
+	}
+
+	std::vector<bool> locked(vertexCount, false);
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			uint32_t a = position[triangles[t * 3 + k]];
+			uint32_t b = position[triangles[t * 3 + (k + 1) % 3]];
+			edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+	}
+
+	for (auto& edge : edgeUses)
+	{
+		if (edge.second == 1)
+		{
+			locked[edge.first >> 32] = true;
+			locked[edge.first & 0xFFFFFFFF] = true;
+		}
+	}
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (referenced[v] && wedges[position[v]] > 1)
+		{
+			locked[position[v]] = true;
+		}
+	}
+
+	//Quadrics and versions are kept per position so every wedge of a seam vertex sees the same error
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		glm::dvec3 a = vertices[triangles[t * 3]].pos;
+		glm::dvec3 b = vertices[triangles[t * 3 + 1]].pos;
+		glm::dvec3 c = vertices[triangles[t * 3 + 2]].pos;
+		glm::dvec3 normal = glm::cross(b - a, c - a);
+
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			vertexTriangles[triangles[t * 3 + k]].push_back(t);
+		}
+
+		if (glm::length(normal) > 0.0)
+		{
+			Quadric plane = makePlaneQuadric(glm::normalize(normal), a);
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				addQuadric(quadrics[position[triangles[t * 3 + k]]], plane);
+			}
+		}
+	}
+
+	std::vector<uint32_t> versions(vertexCount, 0);
+	std::vector<bool> removed(vertexCount, false);
+	std::vector<bool> deadTriangles(triangleCount, false);
+	std::priority_queue<EdgeCollapse, std::vector<EdgeCollapse>, std::greater<EdgeCollapse>> collapses;
+
+	auto pushCollapse = [&](uint32_t from, uint32_t to)
+		{
+			if (from == to || locked[position[from]])
+			{
+				return;
+			}
+
+			Quadric combined = quadrics[position[from]];
+			addQuadric(combined, quadrics[position[to]]);
+
+			collapses.push({ glm::max(evaluateQuadric(combined, vertices[to].pos), 0.0), from, to, versions[position[from]], versions[position[to]] });
+		};
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			pushCollapse(triangles[t * 3 + k], triangles[t * 3 + (k + 1) % 3]);
+			pushCollapse(triangles[t * 3 + (k + 1) % 3], triangles[t * 3 + k]);
+		}
+	}
+
+	//A collapse is rejected if any triangle it keeps would turn over
+	auto flipsTriangle = [&](uint32_t from, uint32_t to)
+		{
+			for (uint32_t t : vertexTriangles[from])
+			{
+				uint32_t* triangle = &triangles[t * 3];
+
+				if (deadTriangles[t] || triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				{
+					continue;
+				}
+
+				glm::vec3 before[3];
+				glm::vec3 after[3];
+
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					before[k] = vertices[triangle[k]].pos;
+					after[k] = triangle[k] == from ? vertices[to].pos : before[k];
+				}
+
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+
+				if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+				{
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+	uint32_t liveTriangles = triangleCount;
+	double maxCost = 0.0;
+
+	while (liveTriangles * 3 > targetCount && !collapses.empty())
+	{
+		EdgeCollapse collapse = collapses.top();
+		collapses.pop();
+
+		if (removed[collapse.from] || removed[collapse.to] || versions[position[collapse.from]] != collapse.fromVersion || versions[position[collapse.to]] != collapse.toVersion)
+		{
+			continue;
+		}
+
+		if (flipsTriangle(collapse.from, collapse.to))
+		{
+			continue;
+		}
+
+		removed[collapse.from] = true;
+
+		for (uint32_t t : vertexTriangles[collapse.from])
+		{
+			uint32_t* triangle = &triangles[t * 3];
+
+			if (deadTriangles[t])
+			{
+				continue;
+			}
+
+			if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+			{
+				deadTriangles[t] = true;
+				liveTriangles--;
+				continue;
+			}
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				if (triangle[k] == collapse.from)
+				{
+					triangle[k] = collapse.to;
+				}
+			}
+
+			vertexTriangles[collapse.to].push_back(t);
+		}
+
+		addQuadric(quadrics[position[collapse.to]], quadrics[position[collapse.from]]);
+		versions[position[collapse.to]]++;
+		maxCost = glm::max(maxCost, collapse.cost);
+
+		//Every edge touching the surviving vertex has a new cost
+		for (uint32_t t : vertexTriangles[collapse.to])
+		{
+			if (deadTriangles[t])
+			{
+				continue;
+			}
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t other = triangles[t * 3 + k];
+
+				if (other != collapse.to)
+				{
+					pushCollapse(other, collapse.to);
+					pushCollapse(collapse.to, other);
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> simplified;
+	simplified.reserve(liveTriangles * 3);
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		if (!deadTriangles[t])
+		{
+			simplified.insert(simplified.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+		}
+	}
+
+	error = (float)glm::sqrt(maxCost);
+
+	return simplified;
+}
+
+//Append simplified copies of the full detail mesh to its index buffer, each aiming for half the triangles of the one before.
+//Stops early once the simplifier cannot make meaningful progress, since a LOD that barely removes anything only costs memory.
+void generateLods(Mesh& mesh)
+{
+	uint32_t baseCount = (uint32_t)mesh.indices.size();
+	uint32_t previousCount = baseCount;
+	float previousError = 0.0f;
+
+	mesh.lods.clear();
+	mesh.lods.push_back({ 0, baseCount, 0.0f });
+
+	for (uint32_t lod = 1; lod < MAX_MESH_LODS; lod++)
+	{
+		float error;
+		std::vector<uint32_t> simplified = simplifyMesh(mesh.vertices, mesh.indices, 0, baseCount, (baseCount >> lod) / 3 * 3, error);
+
+		if (simplified.empty() || simplified.size() * 10 > previousCount * 9)
+		{
+			break;
+		}
+
+		MeshLod meshLod = {};
+		meshLod.firstIndex = (uint32_t)mesh.indices.size();
+		meshLod.indexCount = (uint32_t)simplified.size();
+		meshLod.error = glm::max(error, previousError);
+
+		mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+		optimizeVertexCache(mesh.indices, meshLod.firstIndex, meshLod.indexCount, (uint32_t)mesh.vertices.size());
+
+		mesh.lods.push_back(meshLod);
+		previousCount = meshLod.indexCount;
+		previousError = meshLod.error;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "mesh.h"
+
+//Size of the simulated post-transform vertex cache, small enough to hold on every GPU we target
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+//Average cache miss ratio is transformed vertices per triangle, 0.5 at best for large regular meshes and 3 at worst.
+//Average transform to vertex ratio is transformed vertices per unique vertex, 1 is ideal.
+struct VertexCacheStats
+{
+	float acmr;
+	float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+void optimizeOverdraw(std::vector<uint32_t>& indices, uint32_t first, uint32_t count, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters);
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t first, uint32_t count, uint32_t targetCount, float& error);
+void generateLods(Mesh& mesh);
\ No newline at end of file
@@ -1,17 +1,49 @@
 #include <vulkan/vulkan.h>
 #include <stdexcept>
+#include <cstring>
 
 #include "pipeline_builder.h"
 #include "render_utils.h"
 #include "file_io.h"
 
-VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_t viewportWidth, uint32_t viewportHeight, VkPipelineLayout pipelineLayout, VertexInputDescription inputDescription)
+#ifdef SLOPE_EMBED_SHADERS
+#include "shaders/embedded_shaders.h"
+#endif
+
+//Create a shader module from the SPIR-V compiled into the executable, or read it from disk when shaders are not embedded
+VkShaderModule loadShaderModule(VkDevice device, const char* shaderPath)
 {
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
+#ifdef SLOPE_EMBED_SHADERS
+    for (const EmbeddedShader& shader : EMBEDDED_SHADERS)
+    {
+        if (strcmp(shader.path, shaderPath) == 0)
+        {
+            VkShaderModuleCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            createInfo.codeSize = shader.size;
+            createInfo.pCode = shader.code;
+
+            VkShaderModule shaderModule;
+
+            if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create shader module!");
+            }
+
+            return shaderModule;
+        }
+    }
+#endif
 
-    VkShaderModule vertShaderModule = createShaderModule(device, std::vector(vertShaderCode.begin(), vertShaderCode.end()));
-    VkShaderModule fragShaderModule = createShaderModule(device, std::vector(fragShaderCode.begin(), fragShaderCode.end()));
+    auto shaderCode = readFile(shaderPath);
+
+    return createShaderModule(device, std::vector(shaderCode.begin(), shaderCode.end()));
+}
+
+VkPipeline buildRenderPipeline(VkDevice device, VkPipelineCache pipelineCache, VkFormat colorFormat, VkFormat depthFormat, uint32_t viewportWidth, uint32_t viewportHeight, VkPipelineLayout pipelineLayout, VertexInputDescription inputDescription, bool packedVertices)
+{
+    VkShaderModule vertShaderModule = loadShaderModule(device, "shaders/vert.spv");
+    VkShaderModule fragShaderModule = loadShaderModule(device, "shaders/frag.spv");
 
     VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -19,6 +51,21 @@ VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    //Tell the vertex shader which vertex layout it is reading
+    VkBool32 packedConstant = packedVertices ? VK_TRUE : VK_FALSE;
+
+    VkSpecializationMapEntry packedEntry{};
+    packedEntry.constantID = 0;
+    packedEntry.offset = 0;
+    packedEntry.size = sizeof(VkBool32);
+
+    VkSpecializationInfo vertSpecialization{};
+    vertSpecialization.mapEntryCount = 1;
+    vertSpecialization.pMapEntries = &packedEntry;
+    vertSpecialization.dataSize = sizeof(VkBool32);
+    vertSpecialization.pData = &packedConstant;
+    vertShaderStageInfo.pSpecializationInfo = &vertSpecialization;
+
     VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -129,8 +176,16 @@ VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_
     depthStencil.front = {};
     depthStencil.back = {};
 
+    //Drawn with dynamic rendering, so the pipeline only needs the attachment formats
+    VkPipelineRenderingCreateInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &colorFormat;
+    renderingInfo.depthAttachmentFormat = depthFormat;
+
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = &renderingInfo;
     pipelineInfo.stageCount = 2;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
@@ -142,12 +197,11 @@ VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
+    pipelineInfo.renderPass = VK_NULL_HANDLE;
 
     VkPipeline graphicsPipeline;
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
@@ -156,4 +210,31 @@ VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
 
     return graphicsPipeline;
+}
+
+VkPipeline buildComputePipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, const char* shaderPath)
+{
+    VkShaderModule compShaderModule = loadShaderModule(device, shaderPath);
+
+    VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+    compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compShaderStageInfo.module = compShaderModule;
+    compShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = compShaderStageInfo;
+    pipelineInfo.layout = pipelineLayout;
+
+    VkPipeline computePipeline;
+
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+
+    vkDestroyShaderModule(device, compShaderModule, nullptr);
+
+    return computePipeline;
 }
\ No newline at end of file
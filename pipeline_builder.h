@@ -1,3 +1,5 @@
 #pragma once
 #include "render_types.h"
-VkPipeline buildRenderPipeline(VkDevice device, VkRenderPass renderPass, uint32_t viewportWidth, uint32_t viewportHeight, VkPipelineLayout pipelineLayout, VertexInputDescription inputDescription);
\ No newline at end of file
+VkShaderModule loadShaderModule(VkDevice device, const char* shaderPath);
+VkPipeline buildRenderPipeline(VkDevice device, VkPipelineCache pipelineCache, VkFormat colorFormat, VkFormat depthFormat, uint32_t viewportWidth, uint32_t viewportHeight, VkPipelineLayout pipelineLayout, VertexInputDescription inputDescription, bool packedVertices = false);
+VkPipeline buildComputePipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, const char* shaderPath);
\ No newline at end of file
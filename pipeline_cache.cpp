@@ -0,0 +1,102 @@
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+#include "pipeline_cache.h"
+
+//Check a saved cache was built by this exact device and driver before handing it to the driver
+static bool isCacheValid(const PipelineCacheHeader& header, const VkPhysicalDeviceProperties& properties, size_t fileSize)
+{
+	return header.magic == PIPELINE_CACHE_MAGIC
+		&& header.dataSize == fileSize - sizeof(PipelineCacheHeader)
+		&& header.vendorID == properties.vendorID
+		&& header.deviceID == properties.deviceID
+		&& header.driverVersion == properties.driverVersion
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+//Create a pipeline cache seeded from disk. A missing, truncated or mismatched file starts an empty cache instead.
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath, bool& warm)
+{
+	std::vector<char> fileData;
+	std::ifstream inputStream(filePath, std::ios_base::binary | std::ios_base::ate);
+
+	if (inputStream.is_open())
+	{
+		fileData.resize((size_t)inputStream.tellg());
+		inputStream.seekg(0);
+		inputStream.read(fileData.data(), fileData.size());
+	}
+
+	PipelineCacheHeader header = {};
+	warm = false;
+
+	if (fileData.size() > sizeof(PipelineCacheHeader))
+	{
+		memcpy(&header, fileData.data(), sizeof(PipelineCacheHeader));
+		warm = isCacheValid(header, properties, fileData.size());
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+
+	if (warm)
+	{
+		cacheInfo.initialDataSize = header.dataSize;
+		cacheInfo.pInitialData = fileData.data() + sizeof(PipelineCacheHeader);
+	}
+
+	VkPipelineCache pipelineCache;
+
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline cache");
+	}
+
+	return pipelineCache;
+}
+
+//Write the cache back out with the device it belongs to. Failing to save only costs the next launch a cold start.
+void savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath)
+{
+	size_t dataSize = 0;
+
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	std::vector<char> fileData(sizeof(PipelineCacheHeader) + dataSize);
+
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, fileData.data() + sizeof(PipelineCacheHeader)) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	PipelineCacheHeader header = {};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.dataSize = (uint32_t)dataSize;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	memcpy(fileData.data(), &header, sizeof(PipelineCacheHeader));
+
+	//Write to a temporary file first so an interrupted save never leaves a half written cache behind
+	std::filesystem::path tempPath = filePath;
+	tempPath += ".tmp";
+
+	std::ofstream outputStream(tempPath, std::ios_base::binary | std::ios_base::trunc);
+
+	if (!outputStream.is_open())
+	{
+		return;
+	}
+
+	outputStream.write(fileData.data(), sizeof(PipelineCacheHeader) + dataSize);
+	outputStream.close();
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, filePath, error);
+}
\ No newline at end of file
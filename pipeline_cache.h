@@ -0,0 +1,20 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <filesystem>
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x534C5043;
+
+//Written in front of the driver's cache data. The driver only checks its own UUID, so the driver version is kept here too,
+//since some drivers keep the UUID across updates that change the compiled pipelines.
+struct PipelineCacheHeader
+{
+	uint32_t magic;
+	uint32_t dataSize;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath, bool& warm);
+void savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath);
\ No newline at end of file
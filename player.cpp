@@ -30,5 +30,6 @@ void Player::tick(float delta)
 		transform.position += glm::vec3(glm::vec4(0.0, flySpeed * delta, 0.0, 1.0) * transform.getRotationMatrix());
 	}
 
+	markTransformDirty();
 	setCameraTransform(transform);
 }
\ No newline at end of file
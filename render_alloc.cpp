@@ -136,7 +136,7 @@ void DescriptorWriter::writeBuffer(int binding, VkBuffer buffer, size_t size, si
 	writes.push_back(write);
 }
 
-void DescriptorWriter::writeImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type)
+void DescriptorWriter::writeImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement)
 {
 	VkDescriptorImageInfo& info = imageInfos.emplace_back(VkDescriptorImageInfo{
 		.sampler = sampler,
@@ -147,6 +147,7 @@ void DescriptorWriter::writeImage(int binding, VkImageView image, VkSampler samp
 	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
 
 	write.dstBinding = binding;
+	write.dstArrayElement = arrayElement;
 	write.dstSet = VK_NULL_HANDLE;
 	write.descriptorCount = 1;
 	write.descriptorType = type;
@@ -34,7 +34,7 @@ struct DescriptorWriter
 	std::deque<VkDescriptorBufferInfo> bufferInfos;
 	std::vector<VkWriteDescriptorSet> writes;
 
-	void writeImage(int binding, VkImageView imageView, VkSampler sampler, VkImageLayout layout, VkDescriptorType type);
+	void writeImage(int binding, VkImageView imageView, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement = 0);
 	void writeBuffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type);
 
 	void clear();
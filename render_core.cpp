@@ -4,14 +4,21 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "render_core.h"
 #include "render_utils.h"
 #include "VkBootstrap.h"
 #include "vk_mem_alloc.h"
 #include "pipeline_builder.h"
+#include "pipeline_cache.h"
 #include "mesh.h"
 #include "entity.h"
+#include "math_utils.h"
+#include "render_cull.h"
+#include "cpu_profiler.h"
 
 #define VK_CHECK(x)                                                 \
 	do                                                              \
@@ -27,9 +34,13 @@
 //Initialize base renderer structures
 void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t width, uint32_t height)
 {
-	//Create vulkan instance and window surface
+	PROFILE_SCOPE("Renderer init");
+	auto initStart = std::chrono::high_resolution_clock::now();
+
+	//Create vulkan instance and window surface. Headless rendering has no surface.
 	instance = vkbInstance.instance;
 	this->surface = surface;
+	headless = settings.headless;
 
 	messenger = vkbInstance.debug_messenger;
 	
@@ -40,12 +51,40 @@ void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t w
 	{
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
 		.synchronization2 = true,
+		.dynamicRendering = true,
+	};
+
+	VkPhysicalDeviceVulkan12Features features12 =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.descriptorIndexing = true,
+		.shaderSampledImageArrayNonUniformIndexing = true,
+		.descriptorBindingSampledImageUpdateAfterBind = true,
+		.descriptorBindingUpdateUnusedWhilePending = true,
+		.descriptorBindingPartiallyBound = true,
+		.runtimeDescriptorArray = true,
+		.timelineSemaphore = true,
 	};
 
-	auto devRet = selector.set_surface(*surface)
-		.set_minimum_version(1, 3)
+	VkPhysicalDeviceFeatures features = {};
+	features.multiDrawIndirect = true;
+	features.drawIndirectFirstInstance = true;
+
+	//Without a surface any device with Vulkan 1.3 will do, including software implementations like lavapipe
+	if (headless)
+	{
+		selector.require_present(false);
+	}
+	else
+	{
+		selector.set_surface(*surface);
+	}
+
+	auto devRet = selector.set_minimum_version(1, 3)
 		.prefer_gpu_device_type()
 		.add_required_extension("VK_KHR_shader_draw_parameters")
+		.set_required_features(features)
+		.set_required_features_12(features12)
 		.set_required_features_13(features13)
 		.select();
 	physicalDevice = devRet.value();
@@ -55,8 +94,23 @@ void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t w
 	device = deviceBuilder.build().value();
 
 	graphicsQueue = device.get_queue(vkb::QueueType::graphics).value();
+	gpuProfiler.init(device, physicalDevice.properties.limits.timestampPeriod);
 	graphicsQueueFamily = device.get_queue_index(vkb::QueueType::graphics).value();
 
+	//Uploads go to a separate transfer family when the device has one and share the graphics queue otherwise
+	auto transferRet = device.get_queue(vkb::QueueType::transfer);
+
+	if (transferRet)
+	{
+		transferQueue = transferRet.value();
+		transferQueueFamily = device.get_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		transferQueue = graphicsQueue;
+		transferQueueFamily = graphicsQueueFamily;
+	}
+
 	//Create the memory allocator
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = physicalDevice;
@@ -64,16 +118,36 @@ void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t w
 	allocatorInfo.instance = instance;
 	vmaCreateAllocator(&allocatorInfo, &allocator);
 
+	//The vertex layout is fixed for the lifetime of the renderer since the arena and pipeline are built around it
+	packedVertices = settings.packedVertices;
+	geometry.init(allocator, packedVertices ? sizeof(PackedVertex) : sizeof(Vertex), MAX_GEOMETRY_VERTICES, MAX_GEOMETRY_INDICES);
+	uploader.init(device, allocator, transferQueue, transferQueueFamily, graphicsQueueFamily, STAGING_RING_SIZE);
+
+	//One recording context per worker is created for every frame
+	workers.init(std::clamp(std::thread::hardware_concurrency(), 1u, MAX_RECORD_THREADS));
+
 	//Init functions for all sub-sections of the renderer
 	createSwapchain(width, height);
 	initCommands();
-	initRenderpass();
-	initFramebuffers();
 	initSyncStructures();
 	initDescriptors();
 	
+	//Seed pipeline creation with the cache from the last run, unless a cold start was asked for
+	auto pipelineStart = std::chrono::high_resolution_clock::now();
+	bool pipelineCacheWarm = false;
+
+	if (settings.pipelineCache)
+	{
+		pipelineCache = loadPipelineCache(device, physicalDevice.properties, PIPELINE_CACHE_PATH, pipelineCacheWarm);
+	}
+	else
+	{
+		VkPipelineCacheCreateInfo cacheInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+		VK_CHECK(vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache));
+	}
+
 	//Create render pipeline
-	VertexInputDescription inputDescription = Vertex::getInputDescription();
+	VertexInputDescription inputDescription = Vertex::getInputDescription(packedVertices);
 
 	std::vector<VkDescriptorSetLayout> setLayouts = {globalSetLayout, textureSetLayout};
 
@@ -89,7 +163,55 @@ void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t w
 		throw std::runtime_error("failed to create pipeline layout!");
 	}
 
-	renderPipeline = buildRenderPipeline(device, renderPass, width, height, pipelineLayout, inputDescription);
+	renderPipeline = buildRenderPipeline(device, pipelineCache, swapchainImageFormat, depthFormat, width, height, pipelineLayout, inputDescription, packedVertices);
+
+	//Create culling pipeline
+	VkPushConstantRange cullPushConstant = {};
+	cullPushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	cullPushConstant.offset = 0;
+	cullPushConstant.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo cullLayoutInfo{};
+	cullLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	cullLayoutInfo.setLayoutCount = 1;
+	cullLayoutInfo.pSetLayouts = &cullSetLayout;
+	cullLayoutInfo.pushConstantRangeCount = 1;
+	cullLayoutInfo.pPushConstantRanges = &cullPushConstant;
+
+	if (vkCreatePipelineLayout(device, &cullLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create cull pipeline layout!");
+	}
+
+	cullPipeline = buildComputePipeline(device, pipelineCache, cullPipelineLayout, "shaders/cull.spv");
+
+	//Create depth pyramid reduction pipeline
+	VkPipelineLayoutCreateInfo reduceLayoutInfo{};
+	reduceLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	reduceLayoutInfo.setLayoutCount = 1;
+	reduceLayoutInfo.pSetLayouts = &depthReduceSetLayout;
+
+	if (vkCreatePipelineLayout(device, &reduceLayoutInfo, nullptr, &depthReducePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth reduce pipeline layout!");
+	}
+
+	depthReducePipeline = buildComputePipeline(device, pipelineCache, depthReducePipelineLayout, "shaders/depthreduce.spv");
+
+	//Every pipeline is created by now, so the cache is saved straight away rather than on a clean exit
+	stats.pipelineTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+
+	if (settings.pipelineCache)
+	{
+		savePipelineCache(device, pipelineCache, physicalDevice.properties, PIPELINE_CACHE_PATH);
+	}
+
+	//Occlusion history starts empty, so the first frame draws everything in the late phase
+	visibilityBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	VkCommandBuffer fillCommandBuffer = beginSingleTimeCommands(device, mainCommandPool);
+	vkCmdFillBuffer(fillCommandBuffer, visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	endSingleTimeCommands(device, graphicsQueue, mainCommandPool, fillCommandBuffer);
 
 	//Create Error Texture
 	uint32_t black = 0xFF000000;
@@ -103,20 +225,51 @@ void Renderer::init(vkb::Instance vkbInstance, VkSurfaceKHR* surface, uint32_t w
 		}
 	}
 
-	errorTexture = createImage(pixels.data(), allocator, device, mainCommandPool, graphicsQueue, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, VkExtent3D{16, 16, 1}, VMA_MEMORY_USAGE_GPU_ONLY, 0);
-
+	//Trilinear filtering when minified, magnification stays nearest to keep the textures crisp up close
 	VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
 	samplerInfo.magFilter = VK_FILTER_NEAREST;
-	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 	vkCreateSampler(device, &samplerInfo, nullptr, &defaultSampler);
 
-	errorTexView = createImageView(device, errorTexture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+	//Same filtering pinned to the base level, used when mipmaps are switched off for comparison
+	samplerInfo.maxLod = 0.0f;
+	vkCreateSampler(device, &samplerInfo, nullptr, &baseLevelSampler);
+
+	//Depth and the depth pyramid are read texel by texel, never filtered
+	VkSamplerCreateInfo depthSamplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	depthSamplerInfo.magFilter = VK_FILTER_NEAREST;
+	depthSamplerInfo.minFilter = VK_FILTER_NEAREST;
+	depthSamplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	depthSamplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depthSamplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depthSamplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depthSamplerInfo.minLod = 0.0f;
+	depthSamplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	vkCreateSampler(device, &depthSamplerInfo, nullptr, &depthSampler);
+
+	//The error texture always occupies slot 0 of the texture table and must be usable before the first frame
+	TextureImage errorTextureImage = uploadTexture(std::vector<uint32_t>(pixels.begin(), pixels.end()), 16, 16);
+	errorTexture = errorTextureImage.texture;
+	errorTexView = errorTextureImage.textureView;
+
+	uploader.submit(STAGING_RING_SIZE);
+	acquireUploads();
 
 	mainDeletionQueue.push_function([=]() {
 		vmaDestroyImage(allocator, errorTexture.image, errorTexture.allocation);
 		vkDestroySampler(device, defaultSampler, nullptr);
+		vkDestroySampler(device, baseLevelSampler, nullptr);
+		vkDestroySampler(device, depthSampler, nullptr);
+		vmaDestroyBuffer(allocator, visibilityBuffer.buffer, visibilityBuffer.allocation);
 		vkDestroyImageView(device, errorTexView, nullptr);
 		});
+
+	stats.startupTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - initStart).count();
+
+	std::cout << "Renderer started in " << stats.startupTime << " ms, pipelines built in " << stats.pipelineTime << " ms from a " << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache\n";
 };
 
 //Create swapchain and depth image and fetch swapchain images and image views
@@ -134,18 +287,41 @@ void Renderer::createSwapchain(uint32_t width, uint32_t height)
 
 	depthFormat = VK_FORMAT_D32_SFLOAT;
 
-	depthImage = createImage(allocator, device, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent, VMA_MEMORY_USAGE_GPU_ONLY, VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	depthImage = createImage(allocator, device, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depthImageExtent, VMA_MEMORY_USAGE_GPU_ONLY, VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
 
 	VkImageViewCreateInfo depthViewInfo = imageViewCreateInfo(depthFormat, depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
 
 	VK_CHECK(vkCreateImageView(device, &depthViewInfo, nullptr, &depthImageView));
 
+	createDepthPyramid();
+
+	//Headless rendering uses the format the swapchain would have picked so shading cost matches windowed runs
+	if (headless)
+	{
+		swapchainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+		renderExtent = { width, height };
+
+		offscreenImage = createImage(allocator, device, swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, depthImageExtent, VMA_MEMORY_USAGE_GPU_ONLY, VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+
+		VkImageView offscreenView;
+		VkImageViewCreateInfo offscreenViewInfo = imageViewCreateInfo(swapchainImageFormat, offscreenImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		VK_CHECK(vkCreateImageView(device, &offscreenViewInfo, nullptr, &offscreenView));
+
+		swapchainImages = { offscreenImage.image };
+		swapchainImageViews = { offscreenView };
+
+		return;
+	}
+
+	//Handing over the previous swapchain lets the driver reuse its resources and keep presenting its queued images
 	vkb::SwapchainBuilder swapchainBuilder{ physicalDevice, device, *surface };
 
 	swapchain = swapchainBuilder
 		.use_default_format_selection()
 		.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
 		.set_desired_extent(width, height)
+		.set_old_swapchain(swapchain)
 		.build()
 		.value();
 
@@ -153,6 +329,7 @@ void Renderer::createSwapchain(uint32_t width, uint32_t height)
 	swapchainImageViews = swapchain.get_image_views().value(); 
 
 	swapchainImageFormat = swapchain.image_format;
+	renderExtent = swapchain.extent;
 };
 
 //Callback function for when the window is resized
@@ -168,33 +345,65 @@ void Renderer::cleanupSwapchain()
 {
 	vkDestroyImageView(device, depthImageView, nullptr);
 	vmaDestroyImage(allocator, depthImage.image, depthImage.allocation);
-	
-	for (VkFramebuffer framebuffer : framebuffers)
-	{
-		vkDestroyFramebuffer(device, framebuffer, nullptr);
-	}
+
+	cleanupDepthPyramid();
 
 	for (VkImageView imageView : swapchainImageViews)
 	{
 		vkDestroyImageView(device, imageView, nullptr);
 	}
 
-	vkDestroySwapchainKHR(device, swapchain, nullptr);
+	if (headless)
+	{
+		vmaDestroyImage(allocator, offscreenImage.image, offscreenImage.allocation);
+	}
+	else
+	{
+		vkDestroySwapchainKHR(device, swapchain, nullptr);
+	}
 }
 
-//Delete and recreate the swapchain for when the window is resized. If minimized, wait.
+//Recreate the swapchain for when the window is resized. If minimized, wait.
+//Frames still in flight keep using the old swapchain, depth image and depth pyramid, so instead of idling the device
+//they are retired on the frame timeline and destroyed once the last submitted frame has finished.
 void Renderer::updateSwapchain()
 {
 	if (width == 0 || height == 0)
 	{
 		return;
 	}
-	vkDeviceWaitIdle(device);
 
-	cleanupSwapchain();
+	VkSwapchainKHR oldSwapchain = swapchain.swapchain;
+	std::vector<VkImageView> oldImageViews = swapchainImageViews;
+	AllocatedImage oldDepthImage = depthImage;
+	VkImageView oldDepthImageView = depthImageView;
+	AllocatedImage oldDepthPyramid = depthPyramid;
+	VkImageView oldDepthPyramidView = depthPyramidView;
+	std::vector<VkImageView> oldDepthPyramidLevels = depthPyramidLevels;
 
 	createSwapchain(width, height);
-	initFramebuffers();
+
+	//Frame n - 1 is the last one submitted whichever path got here, and it signals n
+	frameDeletionQueue.push_function(frameNumber, [=]()
+		{
+			for (VkImageView levelView : oldDepthPyramidLevels)
+			{
+				vkDestroyImageView(device, levelView, nullptr);
+			}
+
+			vkDestroyImageView(device, oldDepthPyramidView, nullptr);
+			vmaDestroyImage(allocator, oldDepthPyramid.image, oldDepthPyramid.allocation);
+
+			vkDestroyImageView(device, oldDepthImageView, nullptr);
+			vmaDestroyImage(allocator, oldDepthImage.image, oldDepthImage.allocation);
+
+			for (VkImageView imageView : oldImageViews)
+			{
+				vkDestroyImageView(device, imageView, nullptr);
+			}
+
+			vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+		});
 }
 
 //Create command buffer and command pool
@@ -216,7 +425,7 @@ void Renderer::initCommands()
 			vkDestroyCommandPool(device, mainCommandPool, nullptr);
 		});
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
 		if (vkCreateCommandPool(device, &commandPoolInfo, nullptr, &frames[i].commandPool) != VK_SUCCESS)
 		{
@@ -239,120 +448,77 @@ void Renderer::initCommands()
 			{
 				vkDestroyCommandPool(device, frames[i].commandPool, nullptr);
 			});
-	}
-}
-
-//Create renderpass
-void Renderer::initRenderpass()
-{
-	VkAttachmentDescription colorAttachment = {};
-	colorAttachment.format = swapchainImageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	VkAttachmentReference colorAttachmentRef = {};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = depthFormat;
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	VkAttachmentReference depthAttachmentRef{};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		//Worker pools are reset as a whole each frame, so their buffers are allocated once here
+		frames[i].recordContexts.resize(workers.getThreadCount());
 
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
-	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		for (RecordContext& context : frames[i].recordContexts)
+		{
+			if (vkCreateCommandPool(device, &commandPoolInfo, nullptr, &context.commandPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create command pool");
+			}
 
-	VkAttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
+			VkCommandBufferAllocateInfo secondaryAllocInfo = {};
+			secondaryAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			secondaryAllocInfo.commandPool = context.commandPool;
+			secondaryAllocInfo.commandBufferCount = 1;
+			secondaryAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
 
-	VkRenderPassCreateInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			if (vkAllocateCommandBuffers(device, &secondaryAllocInfo, &context.commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate secondary command buffer");
+			}
 
-	renderPassInfo.attachmentCount = 2;
-	renderPassInfo.pAttachments = &attachments[0];
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
+			VkCommandPool commandPool = context.commandPool;
 
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create render pass");
+			mainDeletionQueue.push_function([=]()
+				{
+					vkDestroyCommandPool(device, commandPool, nullptr);
+				});
+		}
 	}
 }
 
-//Create the framebuffers and attach the swapchain and depth image views
-void Renderer::initFramebuffers()
+//Create the fences and semaphores
+void Renderer::initSyncStructures()
 {
-	VkFramebufferCreateInfo fbInfo = {};
-	fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	fbInfo.pNext = nullptr;
-	fbInfo.renderPass = renderPass;
-	fbInfo.attachmentCount = 1;
-	fbInfo.width = width;
-	fbInfo.height = height;
-	fbInfo.layers = 1;
+	//Frame n signals n + 1 on the frame timeline once its commands have finished
+	VkSemaphoreTypeCreateInfo timelineInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
 
-	const uint32_t swapchainImageCount = swapchainImages.size();
-	framebuffers = std::vector<VkFramebuffer>(swapchainImageCount);
+	VkSemaphoreCreateInfo timelineCreateInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	timelineCreateInfo.pNext = &timelineInfo;
 
-	for (int i = 0; i < swapchainImageCount; i++)
+	if (vkCreateSemaphore(device, &timelineCreateInfo, nullptr, &frameTimeline) != VK_SUCCESS)
 	{
-		VkImageView attachments[2];
-		attachments[0] = swapchainImageViews[i];
-		attachments[1] = depthImageView;
-
-		fbInfo.pAttachments = attachments;
-		fbInfo.attachmentCount = 2;
-		if (vkCreateFramebuffer(device, &fbInfo, nullptr, &framebuffers[i]) != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to create framebuffer");
-		}
+		throw std::runtime_error("Failed to create frame timeline semaphore");
 	}
-}
 
-//Create the fences and semaphores
-void Renderer::initSyncStructures()
-{
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.pNext = nullptr;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	mainDeletionQueue.push_function([=]()
+		{
+			vkDestroySemaphore(device, frameTimeline, nullptr);
+		});
 
+	//Binary semaphores are still needed for acquiring and presenting swapchain images
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
 	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 	semaphoreCreateInfo.pNext = nullptr;
 	semaphoreCreateInfo.flags = 0;
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
-		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &frames[i].renderFence) != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to create fence");
-		}
-
 		if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].renderSemaphore) != VK_SUCCESS || vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].presentSemaphore) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create semaphores");
 		}
 
+		gpuProfiler.createFrame(frames[i].timestamps);
+
 		mainDeletionQueue.push_function([=]()
 			{
-				vkDestroyFence(device, frames[i].renderFence, nullptr);
+				gpuProfiler.destroyFrame(frames[i].timestamps);
 				vkDestroySemaphore(device, frames[i].renderSemaphore, nullptr);
 				vkDestroySemaphore(device, frames[i].presentSemaphore, nullptr);
 			});
@@ -363,17 +529,45 @@ void Renderer::initSyncStructures()
 void Renderer::initDescriptors()
 {
 	//Create buffers
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
-		frames[i].cameraBuffer = createBuffer(allocator, sizeof(Camera), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-		frames[i].instanceBuffer = createBuffer(allocator, sizeof(glm::mat4) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].cameraBuffer = createBuffer(allocator, sizeof(Camera), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].instanceStagingBuffer = createBuffer(allocator, sizeof(InstanceData) * MAX_OBJECTS, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].drawOrderBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		//The cull shader counts into the draw commands and visible lists with atomics and the vertex shader reads the visible list
+		//per instance, so they stay in device local memory and the CPU's share of them arrives through the staging buffers
+		frames[i].indirectBuffer = createBuffer(allocator, sizeof(GPUDrawCommand) * MAX_OBJECTS, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		frames[i].indirectStagingBuffer = createBuffer(allocator, sizeof(GPUDrawCommand) * MAX_OBJECTS, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].batchIndexBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].visibleBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		frames[i].visibleStagingBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		frames[i].lateIndirectBuffer = createBuffer(allocator, sizeof(GPUDrawCommand) * MAX_OBJECTS, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		frames[i].lateVisibleBuffer = createBuffer(allocator, sizeof(uint32_t) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		//Read back on the CPU once the frame's fence has signalled
+		frames[i].cullStatsBuffer = createBuffer(allocator, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 		mainDeletionQueue.push_function([&, i]()
 			{
 				vmaDestroyBuffer(allocator, frames[i].cameraBuffer.buffer, frames[i].cameraBuffer.allocation);
-				vmaDestroyBuffer(allocator, frames[i].instanceBuffer.buffer, frames[i].instanceBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].instanceStagingBuffer.buffer, frames[i].instanceStagingBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].drawOrderBuffer.buffer, frames[i].drawOrderBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].indirectBuffer.buffer, frames[i].indirectBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].indirectStagingBuffer.buffer, frames[i].indirectStagingBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].batchIndexBuffer.buffer, frames[i].batchIndexBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].visibleBuffer.buffer, frames[i].visibleBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].visibleStagingBuffer.buffer, frames[i].visibleStagingBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].lateIndirectBuffer.buffer, frames[i].lateIndirectBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].lateVisibleBuffer.buffer, frames[i].lateVisibleBuffer.allocation);
+				vmaDestroyBuffer(allocator, frames[i].cullStatsBuffer.buffer, frames[i].cullStatsBuffer.allocation);
 			});
 	}
 
+	//Shared by every frame in flight, the copies into it are ordered on the graphics queue
+	instanceBuffer = createBuffer(allocator, sizeof(InstanceData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	mainDeletionQueue.push_function([&]()
+		{
+			vmaDestroyBuffer(allocator, instanceBuffer.buffer, instanceBuffer.allocation);
+		});
+
 	//Create bindings
 	VkDescriptorSetLayoutBinding cameraBufferBinding = {};
 	cameraBufferBinding.binding = 0;
@@ -389,48 +583,135 @@ void Renderer::initDescriptors()
 
 	instanceBufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-	VkDescriptorSetLayoutBinding bindings[] = {cameraBufferBinding, instanceBufferBinding};
+	VkDescriptorSetLayoutBinding visibleBufferBinding = {};
+	visibleBufferBinding.binding = 2;
+	visibleBufferBinding.descriptorCount = 1;
+	visibleBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+	visibleBufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutBinding bindings[] = {cameraBufferBinding, instanceBufferBinding, visibleBufferBinding};
 
 	VkDescriptorSetLayoutBinding textureBinding = {};
 	textureBinding.binding = 0;
-	textureBinding.descriptorCount = 1;
+	textureBinding.descriptorCount = MAX_TEXTURES;
 	textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 
 	textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+	//The texture table is written as textures are uploaded and only the slots in use are ever valid
+	VkDescriptorBindingFlags textureBindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo textureFlagsInfo = {};
+	textureFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	textureFlagsInfo.bindingCount = 1;
+	textureFlagsInfo.pBindingFlags = &textureBindingFlags;
+
 	//Create descriptor set layout
 	VkDescriptorSetLayoutCreateInfo setInfo = {};
 	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	setInfo.pNext = nullptr;
 
-	setInfo.bindingCount = 2;
+	setInfo.bindingCount = 3;
 	setInfo.flags = 0;
 	setInfo.pBindings = &bindings[0];
 
 	VkDescriptorSetLayoutCreateInfo texSetInfo = {};
 	texSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	texSetInfo.pNext = nullptr;
+	texSetInfo.pNext = &textureFlagsInfo;
 
 	texSetInfo.bindingCount = 1;
-	texSetInfo.flags = 0;
+	texSetInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 	texSetInfo.pBindings = &textureBinding;
 
+	//Culling reads the camera, instances, draw order and batch indices and writes the draw commands and visible list.
+	//The late occlusion phase also writes its own draws and visible list, the visibility history and stats, and samples the depth pyramid.
+	VkDescriptorSetLayoutBinding cullBindings[11] = {};
+
+	for (uint32_t i = 0; i < 11; i++)
+	{
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	cullBindings[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	//Each reduction step samples one level and writes the next
+	VkDescriptorSetLayoutBinding reduceBindings[2] = {};
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		reduceBindings[i].binding = i;
+		reduceBindings[i].descriptorCount = 1;
+		reduceBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		reduceBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo reduceSetInfo = {};
+	reduceSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	reduceSetInfo.bindingCount = 2;
+	reduceSetInfo.pBindings = &reduceBindings[0];
+
+	VkDescriptorSetLayoutCreateInfo cullSetInfo = {};
+	cullSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	cullSetInfo.pNext = nullptr;
+
+	cullSetInfo.bindingCount = 11;
+	cullSetInfo.flags = 0;
+	cullSetInfo.pBindings = &cullBindings[0];
+
 	vkCreateDescriptorSetLayout(device, &setInfo, nullptr, &globalSetLayout);
 	vkCreateDescriptorSetLayout(device, &texSetInfo, nullptr, &textureSetLayout);
+	vkCreateDescriptorSetLayout(device, &cullSetInfo, nullptr, &cullSetLayout);
+	vkCreateDescriptorSetLayout(device, &reduceSetInfo, nullptr, &depthReduceSetLayout);
 
 	mainDeletionQueue.push_function([&]()
 		{
 			vkDestroyDescriptorSetLayout(device, globalSetLayout, nullptr);
 			vkDestroyDescriptorSetLayout(device, textureSetLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, cullSetLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, depthReduceSetLayout, nullptr);
+		});
+
+	//Allocate a copy of the texture table per frame in flight from its own update after bind pool,
+	//so a landed texture can be written into a frame's copy once that frame is no longer on the GPU
+	VkDescriptorPoolSize texturePoolSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT };
+
+	VkDescriptorPoolCreateInfo texturePoolInfo = {};
+	texturePoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	texturePoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	texturePoolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+	texturePoolInfo.poolSizeCount = 1;
+	texturePoolInfo.pPoolSizes = &texturePoolSize;
+
+	VK_CHECK(vkCreateDescriptorPool(device, &texturePoolInfo, nullptr, &textureDescriptorPool));
+
+	VkDescriptorSetAllocateInfo textureSetAllocInfo = {};
+	textureSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	textureSetAllocInfo.descriptorPool = textureDescriptorPool;
+	textureSetAllocInfo.descriptorSetCount = 1;
+	textureSetAllocInfo.pSetLayouts = &textureSetLayout;
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		VK_CHECK(vkAllocateDescriptorSets(device, &textureSetAllocInfo, &frames[i].textureSet));
+	}
+
+	mainDeletionQueue.push_function([&]()
+		{
+			vkDestroyDescriptorPool(device, textureDescriptorPool, nullptr);
 		});
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
 		std::vector<DescriptorAllocator::PoolSizeRatio> frameSizes =
 		{
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
 			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }
 		};
 
 		frames[i].descriptorAllocator = DescriptorAllocator{};
@@ -440,184 +721,987 @@ void Renderer::initDescriptors()
 		{
 			frames[i].descriptorAllocator.destroyPools(device);
 		});
+
+		//Each recording thread only ever needs its one global set per frame
+		for (uint32_t j = 0; j < frames[i].recordContexts.size(); j++)
+		{
+			frames[i].recordContexts[j].descriptorAllocator = DescriptorAllocator{};
+			frames[i].recordContexts[j].descriptorAllocator.init(device, 4, frameSizes);
+
+			mainDeletionQueue.push_function([&, i, j]()
+			{
+				frames[i].recordContexts[j].descriptorAllocator.destroyPools(device);
+			});
+		}
 	}
 }
 
-void Renderer::uploadMesh(Mesh& mesh)
+//Create the depth pyramid for the current depth image. Level 0 is half the screen rounded up to a power of two so every level halves exactly,
+//and a texel of level n covers 2^(n+1) screen pixels in each direction, which the cull shader relies on.
+void Renderer::createDepthPyramid()
 {
-	mesh.upload(allocator);
-}
+	depthPyramidExtent = { 1, 1 };
 
-void Renderer::deleteMesh(Mesh& mesh)
-{
-	vkDeviceWaitIdle(device);
-	vmaDestroyBuffer(allocator, mesh.vertexBuffer.buffer, mesh.vertexBuffer.allocation);
-	vmaDestroyBuffer(allocator, mesh.indexBuffer.buffer, mesh.indexBuffer.allocation);
-}
+	while (depthPyramidExtent.width * 2 < width)
+	{
+		depthPyramidExtent.width *= 2;
+	}
 
-TextureImage Renderer::uploadTexture(std::vector<uint32_t> pixels, uint32_t width, uint32_t height)
-{
-	AllocatedImage texture = createImage(pixels.data(), allocator, device, mainCommandPool, graphicsQueue, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, VkExtent3D{ width, height, 1 }, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+	while (depthPyramidExtent.height * 2 < height)
+	{
+		depthPyramidExtent.height *= 2;
+	}
 
-	VkImageView textureView = createImageView(device, texture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+	uint32_t levelCount = getMipLevels(depthPyramidExtent.width, depthPyramidExtent.height);
 
-	TextureImage textureImage = { texture, textureView };
+	depthPyramid = createImage(allocator, device, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, { depthPyramidExtent.width, depthPyramidExtent.height, 1 }, VMA_MEMORY_USAGE_GPU_ONLY, VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), levelCount);
+	depthPyramidView = createImageView(device, depthPyramid.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
 
-	return textureImage;
+	depthPyramidLevels.resize(levelCount);
+
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		VkImageViewCreateInfo levelViewInfo = imageViewCreateInfo(VK_FORMAT_R32_SFLOAT, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		levelViewInfo.subresourceRange.baseMipLevel = i;
+
+		VK_CHECK(vkCreateImageView(device, &levelViewInfo, nullptr, &depthPyramidLevels[i]));
+	}
 }
 
-void Renderer::deleteTexture(TextureImage& texture)
+void Renderer::cleanupDepthPyramid()
 {
-	vkDestroyImageView(device, texture.textureView, nullptr);
-	vmaDestroyImage(allocator, texture.texture.image, texture.texture.allocation);
+	for (VkImageView levelView : depthPyramidLevels)
+	{
+		vkDestroyImageView(device, levelView, nullptr);
+	}
+
+	depthPyramidLevels.clear();
+
+	vkDestroyImageView(device, depthPyramidView, nullptr);
+	vmaDestroyImage(allocator, depthPyramid.image, depthPyramid.allocation);
 }
 
-//Main draw function. Called every frame.
-void Renderer::drawFrame(Scene& scene)
+//Reduce the depth buffer into the pyramid, one dispatch per level.
+//The whole pyramid is rewritten every frame, so its old contents are discarded and it stays in the general layout throughout.
+void Renderer::buildDepthPyramid(VkCommandBuffer commandBuffer)
 {
-	//Set up commands
-	VkCommandBuffer& commandBuffer = getCurrentFrame().commandBuffer;
-
-	//Synchronize and get images
-	VK_CHECK(vkWaitForFences(device, 1, &getCurrentFrame().renderFence, true, 1000000000));
+	GpuScope scope(gpuProfiler, "Depth pyramid");
+
+	VkImageMemoryBarrier2 imageBarriers[2] = {};
+
+	imageBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imageBarriers[0].srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+	imageBarriers[0].srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	imageBarriers[0].dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	imageBarriers[0].dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+	imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarriers[0].image = depthImage.image;
+	imageBarriers[0].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	imageBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imageBarriers[1].srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	imageBarriers[1].srcAccessMask = VK_ACCESS_2_NONE;
+	imageBarriers[1].dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	imageBarriers[1].dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarriers[1].image = depthPyramid.image;
+	imageBarriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+
+	VkDependencyInfo imageDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	imageDepInfo.imageMemoryBarrierCount = 2;
+	imageDepInfo.pImageMemoryBarriers = imageBarriers;
+
+	vkCmdPipelineBarrier2(commandBuffer, &imageDepInfo);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReducePipeline);
+
+	//Each level reads the one written just before it
+	VkMemoryBarrier2 levelBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	levelBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	levelBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	levelBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+
+	VkDependencyInfo levelDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	levelDepInfo.memoryBarrierCount = 1;
+	levelDepInfo.pMemoryBarriers = &levelBarrier;
+
+	for (uint32_t i = 0; i < depthPyramidLevels.size(); i++)
+	{
+		VkDescriptorSet reduceDescriptor = getCurrentFrame().descriptorAllocator.allocate(device, depthReduceSetLayout);
 
-	getCurrentFrame().descriptorAllocator.clearPools(device);
+		DescriptorWriter writer = DescriptorWriter{};
 
-	uint32_t swapchainImageIndex;
-	VkResult result = vkAcquireNextImageKHR(device, swapchain, 1000000000, getCurrentFrame().presentSemaphore, nullptr, &swapchainImageIndex);
+		if (i == 0)
+		{
+			writer.writeImage(0, depthImageView, depthSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
+		else
+		{
+			writer.writeImage(0, depthPyramidLevels[i - 1], depthSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR)
-	{
-		updateSwapchain();
-		resized = false;
-		return;
-	}
+		writer.writeImage(1, depthPyramidLevels[i], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		writer.updateSet(device, reduceDescriptor);
 
-	VK_CHECK(vkResetFences(device, 1, &getCurrentFrame().renderFence));
+		uint32_t levelWidth = std::max(depthPyramidExtent.width >> i, 1u);
+		uint32_t levelHeight = std::max(depthPyramidExtent.height >> i, 1u);
 
-	VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReducePipelineLayout, 0, 1, &reduceDescriptor, 0, nullptr);
+		vkCmdDispatch(commandBuffer, (levelWidth + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, (levelHeight + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, 1);
 
-	//Begin commands and renderpass
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = 0;
-	beginInfo.pInheritanceInfo = nullptr;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkCmdPipelineBarrier2(commandBuffer, &levelDepInfo);
+	}
+}
 
-	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+//Reserve the mesh's slice of the geometry arena and queue its data for the transfer queue.
+//Vertices are converted to the packed layout here if the renderer uses it, and small meshes get 16 bit indices.
+void Renderer::uploadMesh(Mesh& mesh)
+{
+	bool shortIndices = mesh.hasShortIndices();
+	uint32_t handle = geometry.allocate(static_cast<uint32_t>(mesh.vertices.size()), static_cast<uint32_t>(mesh.indices.size()), shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+	uint32_t generation = geometry.getRange(handle).generation;
+	mesh.geometry = handle;
 
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = renderPass;
-	renderPassInfo.framebuffer = framebuffers[swapchainImageIndex];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = swapchain.extent;
+	size_t vertexSize = mesh.vertices.size() * (packedVertices ? sizeof(PackedVertex) : sizeof(Vertex));
+	size_t indexSize = mesh.indices.size() * (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t));
 
-	VkClearValue clearValue;
-	clearValue.color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	std::vector<uint8_t> data(vertexSize + indexSize);
 
-	VkClearValue depthClear;
-	depthClear.depthStencil.depth = 1.f;
+	if (packedVertices)
+	{
+		memcpy(data.data(), mesh.packVertices().data(), vertexSize);
+	}
+	else
+	{
+		memcpy(data.data(), mesh.vertices.data(), vertexSize);
+	}
 
-	VkClearValue clearValues[] = { clearValue, depthClear };
+	if (shortIndices)
+	{
+		uint16_t* shortIndexData = (uint16_t*)(data.data() + vertexSize);
 
-	renderPassInfo.clearValueCount = 2;
-	renderPassInfo.pClearValues = &clearValues[0];
+		for (size_t i = 0; i < mesh.indices.size(); i++)
+		{
+			shortIndexData[i] = (uint16_t)mesh.indices[i];
+		}
+	}
+	else
+	{
+		memcpy(data.data() + vertexSize, mesh.indices.data(), indexSize);
+	}
 
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	uploader.enqueue(std::move(data), [=](VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, OwnershipTransfer& transfer)
+		{
+			geometry.recordUpload(commandBuffer, handle, generation, stagingBuffer, stagingOffset, transfer);
+		},
+		[=]()
+		{
+			geometry.markResident(handle, generation);
+		});
+}
 
-	glm::mat4 view = glm::lookAt(scene.cameraTransform.position, scene.cameraTransform.position + glm::vec3(glm::vec4(1, 0, 0, 1) * scene.cameraTransform.getRotationMatrix()), glm::vec3(glm::vec4(0, 0, 1, 1) * scene.cameraTransform.getRotationMatrix()));
-	glm::mat4 projection = glm::rotate(glm::perspective(glm::radians(45.0f), width / (float)height, 0.1f, 40.0f), glm::radians(180.0f), glm::vec3(0.0, 0.0, 1.0));
+//Block until the transfer queue is idle and take ownership of everything it has finished
+void Renderer::acquireUploads()
+{
+	vkDeviceWaitIdle(device);
 
-	Camera camera = { view, projection };
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, mainCommandPool);
+	uploader.acquire(commandBuffer);
+	endSingleTimeCommands(device, graphicsQueue, mainCommandPool, commandBuffer);
 
-	//Upload camera and instance matrices to the GPU
-	void* cameraData;
-	vmaMapMemory(allocator, getCurrentFrame().cameraBuffer.allocation, &cameraData);
-	memcpy(cameraData, &camera, sizeof(Camera));
-	vmaUnmapMemory(allocator, getCurrentFrame().cameraBuffer.allocation);
+	//Nothing is in flight, so every frame's copy of the texture table can take the landed textures now
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		bindLandedTextures(frames[i]);
+	}
+}
 
-	std::vector<glm::mat4> transforms;
+//Free the mesh's slice of the geometry arena, compacting the arena once enough space is lost to holes
+void Renderer::deleteMesh(Mesh& mesh)
+{
+	vkDeviceWaitIdle(device);
+	geometry.free(mesh.geometry);
 
-	for (std::unique_ptr<Entity> &entity : scene.entities)
+	if (geometry.isFragmented())
 	{
-		transforms.push_back(entity->transform.getTransformMatrix());
+		//Compaction only moves meshes the graphics queue owns, so finish off anything still on the transfer queue first
+		acquireUploads();
+		geometry.compact(device, mainCommandPool, graphicsQueue);
 	}
+}
 
-	void* instanceData;
-	vmaMapMemory(allocator, getCurrentFrame().instanceBuffer.allocation, &instanceData);
-	memcpy(instanceData, transforms.data(), sizeof(glm::mat4) * transforms.size());
-	vmaUnmapMemory(allocator, getCurrentFrame().instanceBuffer.allocation);
+//Create the texture image and queue its pixels for the transfer queue, instances sample the error texture until the copy lands.
+//The transfer queue only fills the base level, the rest of the mip chain is blitted on the graphics queue once it owns the image.
+TextureImage Renderer::uploadTexture(std::vector<uint32_t> pixels, uint32_t width, uint32_t height)
+{
+	VkExtent3D extent = { width, height, 1 };
+	uint32_t mipLevels = getMipLevels(width, height);
+	AllocatedImage texture = createImage(allocator, device, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent, VMA_MEMORY_USAGE_GPU_ONLY, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels);
 
-	//Create descriptor set
-	VkDescriptorSet globalDescriptor = getCurrentFrame().descriptorAllocator.allocate(device, globalSetLayout);
+	VkImageView textureView = createImageView(device, texture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 
-	DescriptorWriter writer = DescriptorWriter{};
-	writer.writeBuffer(0, getCurrentFrame().cameraBuffer.buffer, sizeof(Camera), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.writeBuffer(1, getCurrentFrame().instanceBuffer.buffer, sizeof(MeshInstance) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-	writer.updateSet(device, globalDescriptor);
+	TextureImage textureImage = { texture, textureView, registerTexture() };
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &globalDescriptor, 0, nullptr);
+	std::vector<uint8_t> data(pixels.size() * sizeof(uint32_t));
+	memcpy(data.data(), pixels.data(), data.size());
 
-	//Set up window settings
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(width);
-	viewport.height = static_cast<float>(height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	//The texture may be deleted, and its slot reused, before the request reaches the transfer queue.
+	//Like mesh handles, the slot's generation tells a stale request to leave the image and slot alone.
+	VkImage image = texture.image;
+	uint32_t index = textureImage.index;
+	uint32_t generation = textureGenerations[index];
+	uploader.enqueue(std::move(data), [=](VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, OwnershipTransfer& transfer)
+		{
+			if (textureGenerations[index] != generation)
+			{
+				return;
+			}
 
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent.width = width;
-	scissor.extent.height = height;
-	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+			transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderPipeline);
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = stagingOffset;
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = 0;
+			copyRegion.imageSubresource.baseArrayLayer = 0;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageExtent = extent;
 
-	//Main draw loop
-	for (int i = 0; i < scene.entities.size(); i++)
-	{
-		MeshInstance& instance = scene.entities[i]->mesh;
+			vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
-		VkDescriptorSet texDescriptor = getCurrentFrame().descriptorAllocator.allocate(device, textureSetLayout);
+			//A single level image moves to shader read as part of the handover, otherwise it stays ready for the blits
+			VkImageMemoryBarrier2 barrier = { .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.image = image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+			if (mipLevels > 1)
+			{
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+				barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			}
+			else
+			{
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+				barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			}
+
+			transfer.images.push_back(barrier);
+		},
+		[=]()
+		{
+			if (textureGenerations[index] == generation)
+			{
+				textureViews[index] = textureView;
+
+				for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+				{
+					frames[i].landedTextures.push_back({ index, textureView });
+				}
+			}
+		},
+		[=](VkCommandBuffer commandBuffer)
+		{
+			if (mipLevels > 1 && textureGenerations[index] == generation)
+			{
+				generateMipmaps(commandBuffer, image, VkExtent2D{ width, height }, mipLevels);
+			}
+		});
 
-		DescriptorWriter texWriter = DescriptorWriter{};
-		texWriter.writeImage(0, instance.texture->textureView, defaultSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		texWriter.updateSet(device, texDescriptor);
+	return textureImage;
+}
 
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &texDescriptor, 0, nullptr);
+//Uploads already on the transfer queue are acquired first so their barriers and blits never touch a destroyed image,
+//and any request still queued behind them is left stale by bumping the slot's generation
+void Renderer::deleteTexture(TextureImage& texture)
+{
+	acquireUploads();
+	textureGenerations[texture.index]++;
 
-		VkDeviceSize offsets[] = { 0 };
+	//Point the freed slot back at the error texture so stale indices never sample a destroyed view
+	DescriptorWriter writer = DescriptorWriter{};
+	writer.writeImage(0, errorTexView, getTextureSampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture.index);
 
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &instance.mesh->vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, instance.mesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(commandBuffer, instance.mesh->indices.size(), 1, 0, 0, i);
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		writer.updateSet(device, frames[i].textureSet);
 	}
 
-	//End renderpass and commands
-	vkCmdEndRenderPass(commandBuffer);
+	freeTextureSlots.push_back(texture.index);
+	textureViews[texture.index] = errorTexView;
 
-	VK_CHECK(vkEndCommandBuffer(commandBuffer));
+	vkDestroyImageView(device, texture.textureView, nullptr);
+	vmaDestroyImage(allocator, texture.texture.image, texture.texture.allocation);
+}
+
+//Reserve a free slot of the texture table and return its index. The slot shows the error texture until its upload lands,
+//so instances can carry the real index from the start.
+uint32_t Renderer::registerTexture()
+{
+	uint32_t index;
+
+	if (!freeTextureSlots.empty())
+	{
+		index = freeTextureSlots.back();
+		freeTextureSlots.pop_back();
+	}
+	else
+	{
+		if (nextTextureIndex == MAX_TEXTURES)
+		{
+			throw std::runtime_error("Texture table is full");
+		}
+
+		index = nextTextureIndex++;
+	}
+
+	//The error texture registers itself, its slot stays unwritten until its own upload lands.
+	//No frame in flight uses a free slot, so every copy of the table is written straight away.
+	if (errorTexView != VK_NULL_HANDLE)
+	{
+		DescriptorWriter writer = DescriptorWriter{};
+		writer.writeImage(0, errorTexView, getTextureSampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, index);
+
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			writer.updateSet(device, frames[i].textureSet);
+		}
+	}
+
+	textureViews[index] = errorTexView;
+
+	return index;
+}
+
+//Point a frame's copy of the texture table at the textures that landed since the frame last ran.
+//Only called once the frame's previous submission has finished, so none of its slots are in use on the GPU.
+void Renderer::bindLandedTextures(FrameData& frame)
+{
+	if (frame.landedTextures.empty())
+	{
+		return;
+	}
+
+	DescriptorWriter writer = DescriptorWriter{};
+
+	for (auto& texture : frame.landedTextures)
+	{
+		writer.writeImage(0, texture.second, getTextureSampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture.first);
+	}
+
+	writer.updateSet(device, frame.textureSet);
+	frame.landedTextures.clear();
+}
+
+VkSampler Renderer::getTextureSampler()
+{
+	return settings.textureMipmaps ? defaultSampler : baseLevelSampler;
+}
+
+//Rewrite every slot of the texture table with the sampler matching the mipmap setting
+void Renderer::updateTextureSamplers()
+{
+	vkDeviceWaitIdle(device);
+
+	DescriptorWriter writer = DescriptorWriter{};
+
+	for (uint32_t i = 0; i < nextTextureIndex; i++)
+	{
+		writer.writeImage(0, textureViews[i], getTextureSampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, i);
+	}
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		writer.updateSet(device, frames[i].textureSet);
+	}
+
+	textureMipmapsBound = settings.textureMipmaps;
+}
+
+static_assert(sizeof(InstanceData) == 32, "InstanceData must match the std430 layout in the shaders");
+static_assert(MAX_TEXTURES <= 1 << 16, "Texture indices are packed into 16 bits of InstanceData");
+
+//Fill in an instance's transform in the compact layout the shaders unpack
+static void packInstance(InstanceData& instance, glm::vec3 position, glm::quat rotation, glm::vec3 scale, uint32_t textureIndex)
+{
+	instance.position = position;
+	instance.rotation[0] = glm::packSnorm2x16(glm::vec2(rotation.x, rotation.y));
+	instance.rotation[1] = glm::packSnorm2x16(glm::vec2(rotation.z, rotation.w));
+	instance.scaleXY = glm::packHalf2x16(glm::vec2(scale.x, scale.y));
+	instance.scaleZTexture = glm::packHalf1x16(scale.z) | (textureIndex << 16);
+}
+
+//Pack the instances that changed since the last frame into this frame's staging buffer and copy each run of neighbouring entities
+//into the instance buffer. Everything is uploaded again when the scene's entities change.
+void Renderer::updateInstances(VkCommandBuffer commandBuffer, Scene& scene)
+{
+	PROFILE_SCOPE("Update instances");
+
+	uint32_t entityCount = std::min((uint32_t)scene.entities.size(), MAX_OBJECTS);
+	dirtyInstances.clear();
+
+	if (scene.instancesStale || entityCount != instanceCount)
+	{
+		for (uint32_t i = 0; i < entityCount; i++)
+		{
+			dirtyInstances.push_back(i);
+		}
+
+		scene.instancesStale = false;
+		instanceCount = entityCount;
+		cullTransforms.resize(entityCount);
+	}
+	else
+	{
+		for (uint32_t index : scene.dirtyEntities)
+		{
+			if (index < entityCount)
+			{
+				dirtyInstances.push_back(index);
+			}
+		}
+
+		std::sort(dirtyInstances.begin(), dirtyInstances.end());
+	}
+
+	scene.dirtyEntities.clear();
+	stats.instancesUpdated = dirtyInstances.size();
+
+	if (dirtyInstances.empty())
+	{
+		return;
+	}
+
+	InstanceData* instances = (InstanceData*)getCurrentFrame().instanceStagingBuffer.mappedData;
+	instanceCopies.clear();
+
+	for (uint32_t i = 0; i < dirtyInstances.size(); i++)
+	{
+		uint32_t index = dirtyInstances[i];
+		Entity* entity = scene.entities[index].get();
+		Transform& transform = entity->transform;
+
+		entity->instanceIndex = index;
+		entity->transformDirty = false;
+
+		//The CPU culler reads the same entities through the draw order, so its matrices are refreshed alongside
+		cullTransforms[index] = transform.getTransformMatrix();
+
+		glm::vec3 position = transform.position;
+		glm::quat rotation = glm::normalize(quatFromEulerAngles(transform.rotation));
+		glm::vec3 scale = transform.scale;
+
+		//Packed positions are offset and scaled back to mesh space ahead of the instance transform
+		if (packedVertices)
+		{
+			position += rotation * (scale * entity->mesh.mesh->bounds.aabbMin);
+			scale *= entity->mesh.mesh->getDequantizeScale();
+		}
+
+		packInstance(instances[i], position, rotation, scale, entity->mesh.texture->index);
+		instances[i].objectId = index;
+
+		VkDeviceSize dstOffset = sizeof(InstanceData) * index;
+
+		if (!instanceCopies.empty() && instanceCopies.back().dstOffset + instanceCopies.back().size == dstOffset)
+		{
+			instanceCopies.back().size += sizeof(InstanceData);
+		}
+		else
+		{
+			instanceCopies.push_back({ sizeof(InstanceData) * i, dstOffset, sizeof(InstanceData) });
+		}
+	}
+
+	//The previous frame may still be reading the instance buffer
+	VkMemoryBarrier2 barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_NONE;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+	VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+
+	vkCmdCopyBuffer(commandBuffer, getCurrentFrame().instanceStagingBuffer.buffer, instanceBuffer.buffer, (uint32_t)instanceCopies.size(), instanceCopies.data());
+
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+
+	vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+}
+
+//Copy the draw commands built on the CPU, and the visible list when the CPU decided visibility, into the device local buffers
+//the cull shader and draws use. Late commands start out as a second copy of the same commands.
+void Renderer::uploadDrawLists(VkCommandBuffer commandBuffer, bool visibleList, bool lateCommands)
+{
+	FrameData& frame = getCurrentFrame();
+	VkDeviceSize commandSize = sizeof(GPUDrawCommand) * batches.size();
+	VkDeviceSize visibleSize = sizeof(uint32_t) * drawOrder.size();
+
+	bool copyCommands = commandSize > 0;
+	bool copyVisible = visibleList && visibleSize > 0;
+
+	if (!copyCommands && !copyVisible)
+	{
+		return;
+	}
+
+	//The last frame to use this slot has finished on the GPU, but its reads must still be ordered before the copies
+	VkMemoryBarrier2 barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_NONE;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+	VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+
+	if (copyCommands)
+	{
+		VkBufferCopy commandCopy = { 0, 0, commandSize };
+		vkCmdCopyBuffer(commandBuffer, frame.indirectStagingBuffer.buffer, frame.indirectBuffer.buffer, 1, &commandCopy);
+
+		if (lateCommands)
+		{
+			vkCmdCopyBuffer(commandBuffer, frame.indirectStagingBuffer.buffer, frame.lateIndirectBuffer.buffer, 1, &commandCopy);
+		}
+	}
+
+	if (copyVisible)
+	{
+		VkBufferCopy visibleCopy = { 0, 0, visibleSize };
+		vkCmdCopyBuffer(commandBuffer, frame.visibleStagingBuffer.buffer, frame.visibleBuffer.buffer, 1, &visibleCopy);
+	}
+
+	//The cull shader counts into the copied commands, the draws read them and the vertex shader reads the visible list
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+}
+
+//Main draw function. Called every frame.
+void Renderer::drawFrame(Scene& scene)
+{
+	PROFILE_SCOPE("Draw frame");
+
+	//Slots are only reused once their own last submission has finished, so the setting can change between any two frames
+	framesInFlight = std::clamp(settings.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+	//Set up commands
+	VkCommandBuffer& commandBuffer = getCurrentFrame().commandBuffer;
+
+	//Wait until fewer than framesInFlight frames are queued and this slot's last submission is done with its resources
+	uint64_t frameValue = frameNumber + 1;
+	uint64_t waitValue = std::max(getCurrentFrame().timelineValue, frameValue > framesInFlight ? frameValue - framesInFlight : 0);
+
+	{
+		PROFILE_SCOPE("Frame wait");
+
+		VkSemaphoreWaitInfo waitInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &frameTimeline;
+		waitInfo.pValues = &waitValue;
+
+		VK_CHECK(vkWaitSemaphores(device, &waitInfo, 1000000000));
+	}
+
+	//Destroy whatever was retired by frames the GPU has finished since
+	uint64_t completedValue;
+	VK_CHECK(vkGetSemaphoreCounterValue(device, frameTimeline, &completedValue));
+	frameDeletionQueue.flush(completedValue);
+
+	//The late cull phase's occlusion count from this slot's last submission is complete once the timeline has reached it.
+	//It is then reset for this frame's dispatch.
+	uint32_t* occludedInstances = (uint32_t*)getCurrentFrame().cullStatsBuffer.mappedData;
+	stats.occludedInstances = 0;
+
+	if (getCurrentFrame().cullStatsWritten)
+	{
+		vmaInvalidateAllocation(allocator, getCurrentFrame().cullStatsBuffer.allocation, 0, VK_WHOLE_SIZE);
+		stats.occludedInstances = *occludedInstances;
+		getCurrentFrame().cullStatsWritten = false;
+	}
+
+	*occludedInstances = 0;
+	vmaFlushAllocation(allocator, getCurrentFrame().cullStatsBuffer.allocation, 0, VK_WHOLE_SIZE);
+
+	{
+		PROFILE_SCOPE("Descriptors");
+
+		if (settings.textureMipmaps != textureMipmapsBound)
+		{
+			updateTextureSamplers();
+		}
+
+		getCurrentFrame().descriptorAllocator.clearPools(device);
+	}
+
+	uint32_t swapchainImageIndex = 0;
+	VkResult result = VK_SUCCESS;
+
+	if (!headless)
+	{
+		PROFILE_SCOPE("Acquire");
+		result = vkAcquireNextImageKHR(device, swapchain, 1000000000, getCurrentFrame().presentSemaphore, nullptr, &swapchainImageIndex);
+	}
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		updateSwapchain();
+		resized = false;
+		return;
+	}
+
+	VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+
+	//Begin commands
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = 0;
+	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+	//Collect this slot's timings from its last submission, which the timeline wait above has shown to be finished.
+	//The whole frame is timed so settings that only change shading cost, like mipmaps, can be compared.
+	gpuProfiler.beginFrame(commandBuffer, getCurrentFrame().timestamps);
+	uint32_t frameScope = gpuProfiler.beginScope("Frame");
+
+	//Hand new uploads to the transfer queue and pick up whatever it has already finished. Nothing here waits on the transfers.
+	uploader.submit(settings.uploadBudget);
+	uint64_t uploadWaitValue = uploader.acquire(commandBuffer);
+	bindLandedTextures(getCurrentFrame());
+
+	glm::mat4 view = glm::lookAt(scene.cameraTransform.position, scene.cameraTransform.position + glm::vec3(glm::vec4(1, 0, 0, 1) * scene.cameraTransform.getRotationMatrix()), glm::vec3(glm::vec4(0, 0, 1, 1) * scene.cameraTransform.getRotationMatrix()));
+	glm::mat4 projection = glm::rotate(glm::perspective(glm::radians(CAMERA_FOV), width / (float)height, CAMERA_NEAR, CAMERA_FAR), glm::radians(180.0f), glm::vec3(0.0, 0.0, 1.0));
+
+	Camera camera = { view, projection };
+	extractFrustumPlanes(projection * view, camera.frustum);
+
+	//Upload the camera to the GPU. The per-frame buffers stay mapped for their whole lifetime.
+	memcpy(getCurrentFrame().cameraBuffer.mappedData, &camera, sizeof(Camera));
+
+	bool gpuCulling = settings.drawMode == DrawMode::Indirect && settings.cullMode == CullMode::GPU;
+	bool cpuCulling = settings.drawMode == DrawMode::Indirect && settings.cullMode == CullMode::CPU;
+	bool occlusionCulling = gpuCulling && settings.occlusionCulling;
+
+	//Draw slots are filled in sort key order, grouped by mesh and nearest first within each mesh
+	buildBatches(scene, view);
+
+	updateInstances(commandBuffer, scene);
+
+	{
+		PROFILE_SCOPE("Build instances");
+
+		//Instances stay where they are in the instance buffer, the draw order only lists which entity each slot draws
+		memcpy(getCurrentFrame().drawOrderBuffer.mappedData, drawOrder.data(), sizeof(uint32_t) * drawOrder.size());
+	}
+
+	stats.visibleInstances = drawOrder.size();
+
+	if (cpuCulling)
+	{
+		//Compact each batch's visible instances in place so the draw commands only cover survivors
+		PROFILE_SCOPE("CPU cull");
+		auto cullStart = std::chrono::high_resolution_clock::now();
+
+		uint32_t* visibleInstances = (uint32_t*)getCurrentFrame().visibleStagingBuffer.mappedData;
+
+		stats.visibleInstances = 0;
+
+		for (DrawBatch& batch : batches)
+		{
+			batch.instanceCount = culler.cull(cullTransforms.data(), &drawOrder[batch.firstInstance], batch.instanceCount, batch.mesh->bounds.sphere, camera.frustum, batch.firstInstance, &visibleInstances[batch.firstInstance]);
+			stats.visibleInstances += batch.instanceCount;
+
+			//The culler returns draw slots, the shaders look instances up by entity
+			for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++)
+			{
+				visibleInstances[i] = drawOrder[visibleInstances[i]];
+			}
+		}
+
+		stats.cullTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - cullStart).count();
+	}
+
+	if (settings.drawMode == DrawMode::Indirect)
+	{
+		//With GPU culling the cull shader counts the surviving instances of each batch
+		GPUDrawCommand* commands = (GPUDrawCommand*)getCurrentFrame().indirectStagingBuffer.mappedData;
+
+		for (uint32_t i = 0; i < batches.size(); i++)
+		{
+			const GeometryRange& range = geometry.getRange(batches[i].mesh->geometry);
+			MeshLod lod = batches[i].mesh->getLod(batches[i].lod);
+
+			commands[i].command.indexCount = lod.indexCount;
+			commands[i].command.instanceCount = gpuCulling ? 0 : batches[i].instanceCount;
+			commands[i].command.firstIndex = range.firstIndex + lod.firstIndex;
+			commands[i].command.vertexOffset = range.vertexOffset;
+			commands[i].command.firstInstance = batches[i].firstInstance;
+			commands[i].boundingSphere = packedVertices ? batches[i].mesh->getQuantizedSphere() : batches[i].mesh->bounds.sphere;
+		}
+	}
+
+	if (!gpuCulling && !cpuCulling)
+	{
+		//Without culling every slot is visible and draws the entity the sort put there
+		memcpy(getCurrentFrame().visibleStagingBuffer.mappedData, drawOrder.data(), sizeof(uint32_t) * drawOrder.size());
+	}
+
+	//The late phase fills its own copy of the commands with the instances the early phase missed
+	uploadDrawLists(commandBuffer, !gpuCulling, occlusionCulling);
+
+	if (gpuCulling)
+	{
+		uint32_t* batchIndices = (uint32_t*)getCurrentFrame().batchIndexBuffer.mappedData;
+
+		for (uint32_t i = 0; i < batches.size(); i++)
+		{
+			for (uint32_t j = 0; j < batches[i].instanceCount; j++)
+			{
+				batchIndices[batches[i].firstInstance + j] = i;
+			}
+		}
+
+		cullInstances(commandBuffer, drawOrder.size(), occlusionCulling ? CullPhase::Early : CullPhase::Frustum);
+	}
+
+	//Attach the swapchain image and depth image directly, there are no render pass or framebuffer objects to rebuild on resize
+	VkRenderingAttachmentInfo colorAttachment = { .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+	colorAttachment.imageView = swapchainImageViews[swapchainImageIndex];
+	colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.clearValue.color = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	VkRenderingAttachmentInfo depthAttachment = { .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+	depthAttachment.imageView = depthImageView;
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.clearValue.depthStencil.depth = 1.f;
+
+	//Record the draws inline, or split them over the worker threads when parallel recording is enabled
+	uint32_t recordThreads = std::min(settings.recordThreads, (uint32_t)getCurrentFrame().recordContexts.size());
+	bool parallelRecording = recordThreads > 1;
+
+	VkRenderingInfo renderingInfo = { .sType = VK_STRUCTURE_TYPE_RENDERING_INFO };
+	renderingInfo.flags = parallelRecording ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+	renderingInfo.renderArea.offset = { 0, 0 };
+	renderingInfo.renderArea.extent = renderExtent;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+
+	//Both attachments are cleared, so their previous contents are discarded on the way into attachment layouts.
+	//The swapchain transition waits on the same stage as the acquire semaphore.
+	//The offscreen image is shared by every frame in flight like the depth image, so it also waits for the last frame's writes.
+	VkImageMemoryBarrier2 attachmentBarriers[2] = {};
+
+	attachmentBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	attachmentBarriers[0].srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	attachmentBarriers[0].srcAccessMask = headless ? VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_2_NONE;
+	attachmentBarriers[0].dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	attachmentBarriers[0].dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+	attachmentBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachmentBarriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachmentBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	attachmentBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	attachmentBarriers[0].image = swapchainImages[swapchainImageIndex];
+	attachmentBarriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	attachmentBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	attachmentBarriers[1].srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+	attachmentBarriers[1].srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	attachmentBarriers[1].dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+	attachmentBarriers[1].dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	attachmentBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachmentBarriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	attachmentBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	attachmentBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	attachmentBarriers[1].image = depthImage.image;
+	attachmentBarriers[1].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	VkDependencyInfo attachmentDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	attachmentDepInfo.imageMemoryBarrierCount = 2;
+	attachmentDepInfo.pImageMemoryBarriers = attachmentBarriers;
+
+	vkCmdPipelineBarrier2(commandBuffer, &attachmentDepInfo);
+
+	uint32_t mainPassScope = gpuProfiler.beginScope("Main pass");
+	vkCmdBeginRendering(commandBuffer, &renderingInfo);
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
+
+	{
+		PROFILE_SCOPE("Record");
+
+		if (parallelRecording)
+		{
+			recordParallel(scene, recordThreads);
+		}
+		else
+		{
+			stats.bindsSkipped = recordDraws(commandBuffer, allocateGlobalSet(getCurrentFrame().descriptorAllocator, getCurrentFrame().visibleBuffer.buffer), getCurrentFrame().indirectBuffer.buffer, scene, 0, getDrawCount());
+		}
+	}
+
+	stats.recordTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - recordStart).count();
+
+	vkCmdEndRendering(commandBuffer);
+	gpuProfiler.endScope(mainPassScope);
+
+	//Test everything against the depth of what was just drawn and draw whatever became visible on top of it
+	if (occlusionCulling)
+	{
+		buildDepthPyramid(commandBuffer);
+		cullInstances(commandBuffer, drawOrder.size(), CullPhase::Late);
+		getCurrentFrame().cullStatsWritten = true;
+
+		//Depth goes back to being an attachment and the late draws wait for the first pass's color writes
+		VkImageMemoryBarrier2 lateBarriers[2] = {};
+
+		lateBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+		lateBarriers[0].srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+		lateBarriers[0].srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+		lateBarriers[0].dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+		lateBarriers[0].dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+		lateBarriers[0].oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		lateBarriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		lateBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		lateBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		lateBarriers[0].image = swapchainImages[swapchainImageIndex];
+		lateBarriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+		lateBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+		lateBarriers[1].srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		lateBarriers[1].srcAccessMask = VK_ACCESS_2_NONE;
+		lateBarriers[1].dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+		lateBarriers[1].dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		lateBarriers[1].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		lateBarriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		lateBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		lateBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		lateBarriers[1].image = depthImage.image;
+		lateBarriers[1].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+		VkDependencyInfo lateDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		lateDepInfo.imageMemoryBarrierCount = 2;
+		lateDepInfo.pImageMemoryBarriers = lateBarriers;
+
+		vkCmdPipelineBarrier2(commandBuffer, &lateDepInfo);
+
+		//Few instances reach the late pass in a steady scene, so it is always recorded inline
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		renderingInfo.flags = 0;
+
+		uint32_t latePassScope = gpuProfiler.beginScope("Late pass");
+		vkCmdBeginRendering(commandBuffer, &renderingInfo);
+		stats.bindsSkipped += recordDraws(commandBuffer, allocateGlobalSet(getCurrentFrame().descriptorAllocator, getCurrentFrame().lateVisibleBuffer.buffer), getCurrentFrame().lateIndirectBuffer.buffer, scene, 0, getDrawCount());
+		vkCmdEndRendering(commandBuffer);
+		gpuProfiler.endScope(latePassScope);
+	}
+
+	//Hand the finished image to the presentation engine. The offscreen image is left as it is.
+	VkImageMemoryBarrier2 presentBarrier = { .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	presentBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	presentBarrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+	presentBarrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+	presentBarrier.dstAccessMask = VK_ACCESS_2_NONE;
+	presentBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	presentBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	presentBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	presentBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	presentBarrier.image = swapchainImages[swapchainImageIndex];
+	presentBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	VkDependencyInfo presentDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	presentDepInfo.imageMemoryBarrierCount = 1;
+	presentDepInfo.pImageMemoryBarriers = &presentBarrier;
+
+	if (!headless)
+	{
+		vkCmdPipelineBarrier2(commandBuffer, &presentDepInfo);
+	}
+
+	gpuProfiler.endScope(frameScope);
+
+	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
 	VkSubmitInfo submit = {};
 	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit.pNext = nullptr;
 
-	//Submit commands
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-	submit.pWaitDstStageMask = &waitStage;
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &getCurrentFrame().presentSemaphore;
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &getCurrentFrame().renderSemaphore;
+	//Submit commands, waiting on the upload timeline when this frame acquired finished transfers.
+	//Those transfers have already completed, so the wait only orders the ownership transfer.
+	//Signals the binary semaphore presentation waits on and this frame's value on the frame timeline.
+	//Headless frames skip the acquire and present semaphores at the front of each list.
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+	VkSemaphore waitSemaphores[] = { getCurrentFrame().presentSemaphore, uploader.getSemaphore() };
+	uint64_t waitValues[] = { 0, uploadWaitValue };
+	VkSemaphore signalSemaphores[] = { getCurrentFrame().renderSemaphore, frameTimeline };
+	uint64_t signalValues[] = { 0, frameValue };
+
+	uint32_t firstSemaphore = headless ? 1 : 0;
+	uint32_t waitCount = (uploadWaitValue ? 2 : 1) - firstSemaphore;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = { .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.waitSemaphoreValueCount = waitCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues + firstSemaphore;
+	timelineInfo.signalSemaphoreValueCount = 2 - firstSemaphore;
+	timelineInfo.pSignalSemaphoreValues = signalValues + firstSemaphore;
+
+	submit.pNext = &timelineInfo;
+	submit.pWaitDstStageMask = waitStages + firstSemaphore;
+	submit.waitSemaphoreCount = waitCount;
+	submit.pWaitSemaphores = waitSemaphores + firstSemaphore;
+	submit.signalSemaphoreCount = 2 - firstSemaphore;
+	submit.pSignalSemaphores = signalSemaphores + firstSemaphore;
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers = &commandBuffer;
 
-	VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submit, getCurrentFrame().renderFence));
+	auto submitStart = std::chrono::high_resolution_clock::now();
+
+	{
+		PROFILE_SCOPE("Submit");
+		VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submit, VK_NULL_HANDLE));
+	}
+
+	stats.submitTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - submitStart).count();
+
+	getCurrentFrame().timelineValue = frameValue;
+
+	if (headless)
+	{
+		frameNumber += 1;
+		return;
+	}
 
 	//Draw to screen
 	VkPresentInfoKHR presentInfo = {};
@@ -632,21 +1716,323 @@ void Renderer::drawFrame(Scene& scene)
 
 	presentInfo.pImageIndices = &swapchainImageIndex;
 
-	result = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+	{
+		PROFILE_SCOPE("Present");
+		result = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+	}
+
+	//Count the frame as submitted first so the old swapchain is retired with it
+	frameNumber += 1;
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || resized)
 	{
 		updateSwapchain();
 		resized = false;
 	}
+}
 
-	frameNumber += 1;
+//Sort entities so instances sharing a mesh LOD are contiguous, then split them into batches
+void Renderer::buildBatches(Scene& scene, const glm::mat4& view)
+{
+	PROFILE_SCOPE("Build batches");
+
+	//Entities whose geometry is still on its way through the transfer queue are left out until it lands
+	renderQueue.clear();
+
+	for (uint32_t i = 0; i < scene.entities.size() && i < MAX_OBJECTS; i++)
+	{
+		MeshInstance& instance = scene.entities[i]->mesh;
+
+		const GeometryRange& range = geometry.getRange(instance.mesh->geometry);
+
+		if (!range.resident)
+		{
+			continue;
+		}
+
+		glm::vec4 viewPosition = view * glm::vec4(scene.entities[i]->transform.position, 1.0f);
+		uint32_t lod = selectLod(*instance.mesh, scene.entities[i]->transform, glm::length(glm::vec3(viewPosition)));
+
+		renderQueue.push(makeSortKey(0, range.indexType == VK_INDEX_TYPE_UINT16, instance.mesh->geometry, lod, instance.texture->index, -viewPosition.z / CAMERA_FAR), i);
+	}
+
+	auto sortStart = std::chrono::high_resolution_clock::now();
+	renderQueue.sort();
+	stats.sortTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - sortStart).count();
+
+	drawOrder.clear();
+	drawLods.clear();
+	stats.triangles = 0;
+
+	for (const RenderQueueEntry& entry : renderQueue.getEntries())
+	{
+		drawOrder.push_back(entry.index);
+		drawLods.push_back(getSortKeyLod(entry.key));
+		stats.triangles += scene.entities[entry.index]->mesh.mesh->getLod(drawLods.back()).indexCount / 3;
+	}
+
+	batches.clear();
+
+	if (settings.drawMode != DrawMode::Indirect)
+	{
+		return;
+	}
+
+	//Draws are already grouped by mesh and LOD, so each run of the same mesh LOD becomes a batch
+	for (uint32_t i = 0; i < drawOrder.size(); i++)
+	{
+		MeshInstance& instance = scene.entities[drawOrder[i]]->mesh;
+
+		if (batches.empty() || batches.back().mesh != instance.mesh || batches.back().lod != drawLods[i])
+		{
+			batches.push_back({ instance.mesh, drawLods[i], i, 0 });
+		}
+
+		batches.back().instanceCount++;
+	}
+}
+
+//Pick the coarsest LOD whose simplification error projects to no more than the configured number of pixels.
+//Distance is measured to the near side of the bounding sphere so an instance never gets coarser as it approaches.
+uint32_t Renderer::selectLod(Mesh& mesh, const Transform& transform, float distance)
+{
+	float scale = glm::max(glm::max(transform.scale.x, transform.scale.y), transform.scale.z);
+	float nearDistance = distance - mesh.bounds.sphere.w * scale;
+
+	if (nearDistance <= CAMERA_NEAR)
+	{
+		return 0;
+	}
+
+	float pixelsPerUnit = height / (2.0f * tanf(glm::radians(CAMERA_FOV) * 0.5f) * nearDistance);
+	uint32_t lod = 0;
+
+	for (uint32_t i = 1; i < mesh.getLodCount(); i++)
+	{
+		if (mesh.getLod(i).error * scale * pixelsPerUnit > settings.lodPixelError)
+		{
+			break;
+		}
+
+		lod = i;
+	}
+
+	return lod;
+}
+
+//Test every instance against the view frustum in a compute shader and compact the survivors into the indirect commands.
+//The early and late phases split the survivors by last frame's visibility and the depth pyramid, see cull.comp.
+void Renderer::cullInstances(VkCommandBuffer commandBuffer, uint32_t instanceCount, CullPhase phase)
+{
+	GpuScope scope(gpuProfiler, phase == CullPhase::Late ? "Late cull" : "Cull");
+
+	VkDescriptorSet cullDescriptor = getCurrentFrame().descriptorAllocator.allocate(device, cullSetLayout);
+
+	DescriptorWriter writer = DescriptorWriter{};
+	writer.writeBuffer(0, getCurrentFrame().cameraBuffer.buffer, sizeof(Camera), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.writeBuffer(1, instanceBuffer.buffer, sizeof(InstanceData) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(2, getCurrentFrame().batchIndexBuffer.buffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(3, getCurrentFrame().indirectBuffer.buffer, sizeof(GPUDrawCommand) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(4, getCurrentFrame().visibleBuffer.buffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(5, getCurrentFrame().lateIndirectBuffer.buffer, sizeof(GPUDrawCommand) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(6, getCurrentFrame().lateVisibleBuffer.buffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(7, visibilityBuffer.buffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeImage(8, depthPyramidView, depthSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.writeBuffer(9, getCurrentFrame().cullStatsBuffer.buffer, sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(10, getCurrentFrame().drawOrderBuffer.buffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.updateSet(device, cullDescriptor);
+
+	CullConstants constants = {};
+	constants.instanceCount = instanceCount;
+	constants.phase = (uint32_t)phase;
+	constants.screenWidth = width;
+	constants.screenHeight = height;
+	constants.pyramidLevels = (uint32_t)depthPyramidLevels.size();
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+	vkCmdDispatch(commandBuffer, (instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	//Make the compacted draws visible to the indirect draw and vertex stages, the visibility history to the next cull
+	//and the occlusion count to the CPU once the frame's fence has signalled
+	VkMemoryBarrier2 barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_HOST_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_HOST_READ_BIT;
+
+	VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+}
+
+//Issue one draw call per entity
+void Renderer::drawDirect(BindCache& binds, Scene& scene, uint32_t first, uint32_t count)
+{
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		Mesh* mesh = scene.entities[drawOrder[i]]->mesh.mesh;
+		const GeometryRange& range = geometry.getRange(mesh->geometry);
+		MeshLod lod = mesh->getLod(drawLods[i]);
+
+		binds.bindIndexBuffer(geometry.getIndexBuffer(range.indexType), range.indexType);
+		vkCmdDrawIndexed(binds.getCommandBuffer(), lod.indexCount, 1, range.firstIndex + lod.firstIndex, range.vertexOffset, i);
+	}
+}
+
+//Every batch lives in the geometry arena, so each run of batches sharing an index width goes out in a single multi draw.
+//The sort key orders batches by index width, so a range splits into at most two runs.
+void Renderer::drawIndirect(BindCache& binds, VkBuffer indirectBuffer, uint32_t first, uint32_t count)
+{
+	uint32_t runStart = first;
+
+	while (runStart < first + count)
+	{
+		VkIndexType indexType = geometry.getRange(batches[runStart].mesh->geometry).indexType;
+		uint32_t runEnd = runStart + 1;
+
+		while (runEnd < first + count && geometry.getRange(batches[runEnd].mesh->geometry).indexType == indexType)
+		{
+			runEnd++;
+		}
+
+		binds.bindIndexBuffer(geometry.getIndexBuffer(indexType), indexType);
+		vkCmdDrawIndexedIndirect(binds.getCommandBuffer(), indirectBuffer, runStart * sizeof(GPUDrawCommand), runEnd - runStart, sizeof(GPUDrawCommand));
+
+		runStart = runEnd;
+	}
+}
+
+//Number of draw list entries this frame, batches when drawing indirectly and instances otherwise
+uint32_t Renderer::getDrawCount()
+{
+	return settings.drawMode == DrawMode::Indirect ? (uint32_t)batches.size() : (uint32_t)drawOrder.size();
+}
+
+//Global set drawing the instances listed in the given visible buffer
+VkDescriptorSet Renderer::allocateGlobalSet(DescriptorAllocator& descriptorAllocator, VkBuffer visibleBuffer)
+{
+	VkDescriptorSet globalDescriptor = descriptorAllocator.allocate(device, globalSetLayout);
+
+	DescriptorWriter writer = DescriptorWriter{};
+	writer.writeBuffer(0, getCurrentFrame().cameraBuffer.buffer, sizeof(Camera), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.writeBuffer(1, instanceBuffer.buffer, sizeof(InstanceData) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.writeBuffer(2, visibleBuffer, sizeof(uint32_t) * MAX_OBJECTS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.updateSet(device, globalDescriptor);
+
+	return globalDescriptor;
+}
+
+//Record a contiguous range of the draw list and return how many redundant binds were dropped
+uint32_t Renderer::recordDraws(VkCommandBuffer commandBuffer, VkDescriptorSet globalDescriptor, VkBuffer indirectBuffer, Scene& scene, uint32_t first, uint32_t count)
+{
+	//Set up window settings
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(width);
+	viewport.height = static_cast<float>(height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent.width = width;
+	scissor.extent.height = height;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	//Everything but the index buffer is shared by every draw, the textures are bindless and all meshes live in the geometry arena
+	VkDescriptorSet descriptorSets[] = { globalDescriptor, getCurrentFrame().textureSet };
+	VkBuffer vertexBuffer = geometry.getVertexBuffer();
+	VkDeviceSize vertexOffset = 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &vertexOffset);
+
+	BindCache binds = BindCache(commandBuffer);
+
+	if (settings.drawMode == DrawMode::Indirect)
+	{
+		drawIndirect(binds, indirectBuffer, first, count);
+	}
+	else
+	{
+		drawDirect(binds, scene, first, count);
+	}
+
+	return binds.getBindsSkipped();
+}
+
+//Split the draw list into one contiguous chunk per thread. Each thread records its chunk into its own secondary command buffer
+//using its own command pool and descriptor allocator, so no Vulkan object is shared between threads.
+void Renderer::recordParallel(Scene& scene, uint32_t threadCount)
+{
+	FrameData& frame = getCurrentFrame();
+	uint32_t drawCount = getDrawCount();
+	uint32_t chunkSize = (drawCount + threadCount - 1) / threadCount;
+	std::vector<uint32_t> bindsSkipped(threadCount);
+
+	workers.run(threadCount, [&](uint32_t thread)
+		{
+			PROFILE_SCOPE("Record secondary");
+
+			RecordContext& context = frame.recordContexts[thread];
+
+			VK_CHECK(vkResetCommandPool(device, context.commandPool, 0));
+			context.descriptorAllocator.clearPools(device);
+
+			//Secondaries inherit the attachment formats of the dynamic rendering instance they execute in
+			VkCommandBufferInheritanceRenderingInfo renderingInheritance = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+			renderingInheritance.colorAttachmentCount = 1;
+			renderingInheritance.pColorAttachmentFormats = &swapchainImageFormat;
+			renderingInheritance.depthAttachmentFormat = depthFormat;
+			renderingInheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+			VkCommandBufferInheritanceInfo inheritanceInfo = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+			inheritanceInfo.pNext = &renderingInheritance;
+
+			VkCommandBufferBeginInfo beginInfo = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+			VK_CHECK(vkBeginCommandBuffer(context.commandBuffer, &beginInfo));
+
+			uint32_t first = std::min(thread * chunkSize, drawCount);
+			uint32_t count = std::min(chunkSize, drawCount - first);
+
+			bindsSkipped[thread] = recordDraws(context.commandBuffer, allocateGlobalSet(context.descriptorAllocator, frame.visibleBuffer.buffer), frame.indirectBuffer.buffer, scene, first, count);
+
+			VK_CHECK(vkEndCommandBuffer(context.commandBuffer));
+		});
+
+	stats.bindsSkipped = 0;
+
+	for (uint32_t skipped : bindsSkipped)
+	{
+		stats.bindsSkipped += skipped;
+	}
+
+	std::vector<VkCommandBuffer> secondaryBuffers;
+
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		secondaryBuffers.push_back(frame.recordContexts[i].commandBuffer);
+	}
+
+	vkCmdExecuteCommands(frame.commandBuffer, (uint32_t)secondaryBuffers.size(), secondaryBuffers.data());
 }
 
 //Delete everything
 void Renderer::cleanup()
 {
 	vkDeviceWaitIdle(device);
+
+	frameDeletionQueue.flush(UINT64_MAX);
 	
 	mainDeletionQueue.flush();
 
@@ -654,10 +2040,22 @@ void Renderer::cleanup()
 
 	vkDestroyPipeline(device, renderPipeline, nullptr);
 
-	vkDestroyRenderPass(device, renderPass, nullptr);
+	vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+
+	vkDestroyPipeline(device, cullPipeline, nullptr);
+
+	vkDestroyPipelineLayout(device, depthReducePipelineLayout, nullptr);
+
+	vkDestroyPipeline(device, depthReducePipeline, nullptr);
+
+	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
 	cleanupSwapchain();
 
+	uploader.destroy();
+	workers.shutdown();
+	geometry.destroy();
+
 	vmaDestroyAllocator(allocator);
 
 	vkDestroyDevice(device, nullptr);
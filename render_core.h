@@ -1,6 +1,7 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <array>
 #include <functional>
 #include <deque>
 
@@ -9,9 +10,44 @@
 #include "mesh.h"
 #include "entity.h"
 #include "engine_types.h"
+#include "render_cull.h"
+#include "render_geometry.h"
+#include "render_upload.h"
+#include "worker_pool.h"
+#include "render_queue.h"
+#include "gpu_profiler.h"
 
-constexpr unsigned int FRAME_OVERLAP = 2;
-constexpr unsigned int MAX_OBJECTS = 10000;
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+//Enough for the largest benchmark scene of 100k entities
+constexpr unsigned int MAX_OBJECTS = 1 << 17;
+constexpr unsigned int CULL_GROUP_SIZE = 64;
+constexpr unsigned int DEPTH_REDUCE_GROUP_SIZE = 8;
+constexpr unsigned int MAX_TEXTURES = 1024;
+constexpr unsigned int MAX_GEOMETRY_VERTICES = 1 << 20;
+constexpr unsigned int MAX_GEOMETRY_INDICES = 1 << 22;
+constexpr unsigned int STAGING_RING_SIZE = 64 * 1024 * 1024;
+constexpr unsigned int MAX_RECORD_THREADS = 16;
+constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+constexpr float CAMERA_FOV = 45.0f;
+constexpr float CAMERA_NEAR = 0.1f;
+constexpr float CAMERA_FAR = 40.0f;
+
+//Which instances a cull dispatch draws, matching the PHASE constants in cull.comp
+enum class CullPhase : uint32_t
+{
+	Frustum,
+	Early,
+	Late
+};
+
+//A run of instances sharing a mesh, drawn by a single indirect command
+struct DrawBatch
+{
+	Mesh* mesh;
+	uint32_t lod;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
 
 class Renderer
 {
@@ -25,6 +61,17 @@ public:
 	void onResized(uint32_t width, uint32_t height);
 	void cleanup();
 
+	bool hasPendingUploads()
+	{
+		return uploader.hasPending();
+	}
+
+	RenderSettings settings;
+	RenderStats stats;
+
+	//GPU time of each pass, read back a few frames late
+	GpuProfiler gpuProfiler;
+
 private:
 	uint32_t width;
 	uint32_t height;
@@ -36,48 +83,114 @@ private:
 	vkb::Device device;
 	VkQueue graphicsQueue;
 	uint32_t graphicsQueueFamily;
+	VkQueue transferQueue;
+	uint32_t transferQueueFamily;
 	vkb::Swapchain swapchain;
 	VkFormat swapchainImageFormat;
 	std::vector<VkImage> swapchainImages;
 	std::vector<VkImageView> swapchainImageViews;
-	VkRenderPass renderPass;
-	std::vector<VkFramebuffer> framebuffers;
+	VkExtent2D renderExtent;
+
+	//Headless rendering draws into a single offscreen image that stands in for the swapchain images
+	bool headless = false;
+	AllocatedImage offscreenImage;
 	VkPipeline renderPipeline;
 	VkPipelineLayout pipelineLayout;
+	VkPipeline cullPipeline;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline depthReducePipeline;
+	VkPipelineLayout depthReducePipelineLayout;
+	VkPipelineCache pipelineCache;
 
 	VkCommandPool mainCommandPool;
 
 	VmaAllocator allocator;
+	GeometryArena geometry;
+	bool packedVertices = false;
+	TransferUploader uploader;
 	DeletionQueue mainDeletionQueue;
 
 	VkImageView depthImageView;
 	AllocatedImage depthImage;
 	VkFormat depthFormat;
 
+	//Farthest depth of each 2x2 block, halving down to a single texel
+	AllocatedImage depthPyramid;
+	VkImageView depthPyramidView;
+	std::vector<VkImageView> depthPyramidLevels;
+	VkExtent2D depthPyramidExtent;
+	VkSampler depthSampler;
+	AllocatedBuffer visibilityBuffer;
+
+	//Every entity's instance data indexed by its place in the scene, only changed entries are copied in each frame
+	AllocatedBuffer instanceBuffer;
+	uint32_t instanceCount = 0;
+	std::vector<uint32_t> dirtyInstances;
+	std::vector<VkBufferCopy> instanceCopies;
+
 	VkDescriptorSetLayout globalSetLayout;
 	VkDescriptorPool descriptorPool;
 
-	FrameData frames[FRAME_OVERLAP];
-	uint32_t frameNumber = 0;
+	//Frame pacing runs on one timeline semaphore, frame n signals n + 1
+	FrameData frames[MAX_FRAMES_IN_FLIGHT];
+	uint32_t framesInFlight = 2;
+	uint64_t frameNumber = 0;
+	VkSemaphore frameTimeline;
+	TimelineDeletionQueue frameDeletionQueue;
 
-	VkImageView errorTexView;
+	VkImageView errorTexView = VK_NULL_HANDLE;
 	AllocatedImage errorTexture;
 
 	VkSampler defaultSampler;
+	VkSampler baseLevelSampler;
+	bool textureMipmapsBound = true;
 
 	VkDescriptorSetLayout textureSetLayout;
+	VkDescriptorPool textureDescriptorPool;
+	uint32_t nextTextureIndex = 0;
+	std::vector<uint32_t> freeTextureSlots;
+	std::array<uint32_t, MAX_TEXTURES> textureGenerations = {};
+	std::array<VkImageView, MAX_TEXTURES> textureViews = {};
+	VkDescriptorSetLayout cullSetLayout;
+	VkDescriptorSetLayout depthReduceSetLayout;
+
+	RenderQueue renderQueue;
+	std::vector<uint32_t> drawOrder;
+	std::vector<uint32_t> drawLods;
+	std::vector<DrawBatch> batches;
+	//Indexed by entity like the instance buffer and refreshed with it
+	std::vector<glm::mat4> cullTransforms;
+	FrustumCuller culler;
+	WorkerPool workers;
 
 	FrameData& getCurrentFrame()
 	{
-		return frames[frameNumber % FRAME_OVERLAP];
+		return frames[frameNumber % framesInFlight];
 	}
 
 	void createSwapchain(uint32_t width, uint32_t height);
 	void updateSwapchain();
 	void cleanupSwapchain();
 	void initCommands();
-	void initRenderpass();
-	void initFramebuffers();
 	void initSyncStructures();
 	void initDescriptors();
+	void createDepthPyramid();
+	void cleanupDepthPyramid();
+	void buildDepthPyramid(VkCommandBuffer commandBuffer);
+	uint32_t registerTexture();
+	void bindLandedTextures(FrameData& frame);
+	void acquireUploads();
+	VkSampler getTextureSampler();
+	void updateTextureSamplers();
+	void buildBatches(Scene& scene, const glm::mat4& view);
+	void updateInstances(VkCommandBuffer commandBuffer, Scene& scene);
+	void uploadDrawLists(VkCommandBuffer commandBuffer, bool visibleList, bool lateCommands);
+	uint32_t selectLod(Mesh& mesh, const Transform& transform, float distance);
+	void cullInstances(VkCommandBuffer commandBuffer, uint32_t instanceCount, CullPhase phase);
+	uint32_t getDrawCount();
+	VkDescriptorSet allocateGlobalSet(DescriptorAllocator& descriptorAllocator, VkBuffer visibleBuffer);
+	uint32_t recordDraws(VkCommandBuffer commandBuffer, VkDescriptorSet globalDescriptor, VkBuffer indirectBuffer, Scene& scene, uint32_t first, uint32_t count);
+	void recordParallel(Scene& scene, uint32_t threadCount);
+	void drawDirect(BindCache& binds, Scene& scene, uint32_t first, uint32_t count);
+	void drawIndirect(BindCache& binds, VkBuffer indirectBuffer, uint32_t first, uint32_t count);
 };
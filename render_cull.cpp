@@ -0,0 +1,206 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <bit>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CULL_SSE
+#include <immintrin.h>
+#endif
+
+#include "render_cull.h"
+#include "math_utils.h"
+
+#if defined(__AVX__)
+constexpr uint32_t CULL_LANES = 8;
+#else
+constexpr uint32_t CULL_LANES = 4;
+#endif
+
+//Transform the mesh sphere by every instance matrix into structure of arrays form, padded to a whole number of lanes
+void FrustumCuller::transformSpheres(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere)
+{
+	uint32_t padded = (count + CULL_LANES - 1) / CULL_LANES * CULL_LANES;
+
+	centerX.resize(padded);
+	centerY.resize(padded);
+	centerZ.resize(padded);
+	radius.resize(padded);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const glm::mat4& m = transforms[indices ? indices[i] : i];
+
+		glm::vec3 center = glm::vec3(m[0]) * sphere.x + glm::vec3(m[1]) * sphere.y + glm::vec3(m[2]) * sphere.z + glm::vec3(m[3]);
+
+		float scale = glm::max(glm::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), glm::dot(glm::vec3(m[1]), glm::vec3(m[1]))), glm::dot(glm::vec3(m[2]), glm::vec3(m[2])));
+
+		centerX[i] = center.x;
+		centerY[i] = center.y;
+		centerZ[i] = center.z;
+		radius[i] = sphere.w * sqrtf(scale);
+	}
+
+	//Padding lanes get an infinitely negative radius so they always fail the plane test
+	for (uint32_t i = count; i < padded; i++)
+	{
+		centerX[i] = 0.0f;
+		centerY[i] = 0.0f;
+		centerZ[i] = 0.0f;
+		radius[i] = -FLT_MAX;
+	}
+}
+
+//Write the indices of the visible instances to visible and return how many there are
+uint32_t FrustumCuller::cull(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere, const glm::vec4 planes[6], uint32_t firstIndex, uint32_t* visible)
+{
+#ifdef CULL_SSE
+	transformSpheres(transforms, indices, count, sphere);
+
+	uint32_t visibleCount = 0;
+
+#if defined(__AVX__)
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm256_set1_ps(planes[p].x);
+		planeY[p] = _mm256_set1_ps(planes[p].y);
+		planeZ[p] = _mm256_set1_ps(planes[p].z);
+		planeW[p] = _mm256_set1_ps(planes[p].w);
+	}
+
+	for (uint32_t i = 0; i < count; i += CULL_LANES)
+	{
+		__m256 x = _mm256_loadu_ps(&centerX[i]);
+		__m256 y = _mm256_loadu_ps(&centerY[i]);
+		__m256 z = _mm256_loadu_ps(&centerZ[i]);
+		__m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])), _mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GT_OQ));
+		}
+
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+#else
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+	}
+
+	for (uint32_t i = 0; i < count; i += CULL_LANES)
+	{
+		__m128 x = _mm_loadu_ps(&centerX[i]);
+		__m128 y = _mm_loadu_ps(&centerY[i]);
+		__m128 z = _mm_loadu_ps(&centerZ[i]);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])), _mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+		}
+
+		uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+#endif
+
+		//Append the lanes that passed every plane in order
+		while (mask != 0)
+		{
+			visible[visibleCount++] = firstIndex + i + std::countr_zero(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return visibleCount;
+#else
+	return cullScalar(transforms, indices, count, sphere, planes, firstIndex, visible);
+#endif
+}
+
+//Reference implementation testing one instance at a time
+uint32_t FrustumCuller::cullScalar(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere, const glm::vec4 planes[6], uint32_t firstIndex, uint32_t* visible)
+{
+	transformSpheres(transforms, indices, count, sphere);
+
+	uint32_t visibleCount = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		bool inside = true;
+
+		for (int p = 0; p < 6; p++)
+		{
+			inside = inside && planes[p].x * centerX[i] + planes[p].y * centerY[i] + planes[p].z * centerZ[i] + planes[p].w > -radius[i];
+		}
+
+		if (inside)
+		{
+			visible[visibleCount++] = firstIndex + i;
+		}
+	}
+
+	return visibleCount;
+}
+
+//Cull a field of randomly placed instances and print the throughput of the SIMD and scalar paths
+void benchmarkCulling(uint32_t instanceCount, uint32_t iterations)
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+
+	std::vector<glm::mat4> transforms(instanceCount);
+
+	for (glm::mat4& transform : transforms)
+	{
+		Transform t;
+		t.position = glm::vec3(position(random), position(random), position(random));
+		t.rotation = glm::vec3(angle(random), angle(random), angle(random));
+		transform = t.getTransformMatrix();
+	}
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 40.0f);
+
+	glm::vec4 planes[6];
+	extractFrustumPlanes(projection * view, planes);
+
+	glm::vec4 sphere = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	std::vector<uint32_t> visible(instanceCount);
+	FrustumCuller culler;
+
+	uint32_t visibleCount = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		visibleCount = culler.cull(transforms.data(), nullptr, instanceCount, sphere, planes, 0, visible.data());
+	}
+	float simdTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		culler.cullScalar(transforms.data(), nullptr, instanceCount, sphere, planes, 0, visible.data());
+	}
+	float scalarTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Culled " << instanceCount << " instances x " << iterations << " iterations, " << visibleCount << " visible\n";
+	std::cout << "SIMD (" << CULL_LANES << " lanes): " << (instanceCount * (double)iterations) / simdTime << " instances/ms\n";
+	std::cout << "Scalar: " << (instanceCount * (double)iterations) / scalarTime << " instances/ms\n";
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+//Tests instance bounding spheres against the view frustum on the CPU, several instances at a time.
+//Instance i uses transforms[indices[i]], or transforms[i] when indices is null.
+class FrustumCuller
+{
+public:
+	uint32_t cull(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere, const glm::vec4 planes[6], uint32_t firstIndex, uint32_t* visible);
+	uint32_t cullScalar(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere, const glm::vec4 planes[6], uint32_t firstIndex, uint32_t* visible);
+
+private:
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	void transformSpheres(const glm::mat4* transforms, const uint32_t* indices, uint32_t count, glm::vec4 sphere);
+};
+
+void benchmarkCulling(uint32_t instanceCount, uint32_t iterations);
\ No newline at end of file
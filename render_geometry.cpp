@@ -0,0 +1,318 @@
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+
+#include "render_geometry.h"
+#include "render_utils.h"
+#include "vk_mem_alloc.h"
+
+void RangeAllocator::init(uint32_t capacity)
+{
+	this->capacity = capacity;
+	reset(0);
+}
+
+//Find the first free range large enough and carve the allocation from its start
+bool RangeAllocator::allocate(uint32_t count, uint32_t& offset)
+{
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); it++)
+	{
+		if (it->second >= count)
+		{
+			offset = it->first;
+			uint32_t remaining = it->second - count;
+			freeRanges.erase(it);
+
+			if (remaining > 0)
+			{
+				freeRanges[offset + count] = remaining;
+			}
+
+			used += count;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Return a range to the pool and merge it with the free ranges on either side
+void RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+	used -= count;
+
+	auto next = freeRanges.lower_bound(offset);
+
+	if (next != freeRanges.end() && offset + count == next->first)
+	{
+		count += next->second;
+		next = freeRanges.erase(next);
+	}
+
+	if (next != freeRanges.begin())
+	{
+		auto previous = std::prev(next);
+
+		if (previous->first + previous->second == offset)
+		{
+			previous->second += count;
+			return;
+		}
+	}
+
+	freeRanges[offset] = count;
+}
+
+//Mark the first used elements as allocated and everything after them as one free range
+void RangeAllocator::reset(uint32_t used)
+{
+	this->used = used;
+	freeRanges.clear();
+
+	if (used < capacity)
+	{
+		freeRanges[used] = capacity - used;
+	}
+}
+
+uint32_t RangeAllocator::getUsed()
+{
+	return used;
+}
+
+//Free space trapped between allocations, which only compaction can reclaim in one piece
+uint32_t RangeAllocator::getHoleSpace()
+{
+	uint32_t holes = 0;
+
+	for (auto& range : freeRanges)
+	{
+		if (range.first + range.second != capacity)
+		{
+			holes += range.second;
+		}
+	}
+
+	return holes;
+}
+
+static VkDeviceSize getIndexSize(VkIndexType indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+//Create the shared buffers in device local memory. Data reaches them through the staging ring.
+void GeometryArena::init(VmaAllocator allocator, uint32_t vertexStride, uint32_t maxVertices, uint32_t maxIndices)
+{
+	this->allocator = allocator;
+	this->vertexStride = vertexStride;
+	this->maxVertices = maxVertices;
+	this->maxIndices = maxIndices;
+
+	createBuffers(vertexBuffer, indexBuffer, shortIndexBuffer);
+
+	vertexAllocator.init(maxVertices);
+	indexAllocator.init(maxIndices);
+	shortIndexAllocator.init(maxIndices);
+}
+
+void GeometryArena::createBuffers(AllocatedBuffer& vertices, AllocatedBuffer& indices, AllocatedBuffer& shortIndices)
+{
+	vertices = createBuffer(allocator, (VkDeviceSize)vertexStride * maxVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	indices = createBuffer(allocator, sizeof(uint32_t) * maxIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	shortIndices = createBuffer(allocator, sizeof(uint16_t) * maxIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+RangeAllocator& GeometryArena::getIndexAllocator(VkIndexType indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? shortIndexAllocator : indexAllocator;
+}
+
+//Reserve ranges of the shared buffers for a mesh and return the handle used to look it up.
+//The mesh is not resident until its upload has been recorded.
+uint32_t GeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType)
+{
+	GeometryRange range = {};
+	range.vertexCount = vertexCount;
+	range.indexCount = indexCount;
+	range.indexType = indexType;
+	range.live = true;
+	range.resident = false;
+
+	if (!vertexAllocator.allocate(range.vertexCount, range.vertexOffset))
+	{
+		throw std::runtime_error("Geometry arena is out of vertex space");
+	}
+
+	if (!getIndexAllocator(indexType).allocate(range.indexCount, range.firstIndex))
+	{
+		vertexAllocator.free(range.vertexOffset, range.vertexCount);
+		throw std::runtime_error("Geometry arena is out of index space");
+	}
+
+	uint32_t handle;
+
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+		range.generation = ranges[handle].generation + 1;
+		ranges[handle] = range;
+	}
+	else
+	{
+		handle = (uint32_t)ranges.size();
+		range.generation = 0;
+		ranges.push_back(range);
+	}
+
+	return handle;
+}
+
+//Copy vertices followed by indices out of the staging buffer into the mesh's current ranges.
+//Offsets are resolved here rather than at allocation so compaction can move meshes that are still queued.
+void GeometryArena::recordUpload(VkCommandBuffer commandBuffer, uint32_t handle, uint32_t generation, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, OwnershipTransfer& transfer)
+{
+	GeometryRange& range = ranges[handle];
+
+	if (!range.live || range.generation != generation)
+	{
+		return;
+	}
+
+	VkBuffer rangeIndexBuffer = getIndexBuffer(range.indexType);
+	VkDeviceSize indexSize = getIndexSize(range.indexType);
+
+	VkBufferCopy vertexCopy = {};
+	vertexCopy.srcOffset = stagingOffset;
+	vertexCopy.dstOffset = (VkDeviceSize)vertexStride * range.vertexOffset;
+	vertexCopy.size = (VkDeviceSize)vertexStride * range.vertexCount;
+
+	VkBufferCopy indexCopy = {};
+	indexCopy.srcOffset = stagingOffset + vertexCopy.size;
+	indexCopy.dstOffset = indexSize * range.firstIndex;
+	indexCopy.size = indexSize * range.indexCount;
+
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, vertexBuffer.buffer, 1, &vertexCopy);
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, rangeIndexBuffer, 1, &indexCopy);
+
+	VkBufferMemoryBarrier2 vertexBarrier = { .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+	vertexBarrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT;
+	vertexBarrier.dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT;
+	vertexBarrier.buffer = vertexBuffer.buffer;
+	vertexBarrier.offset = vertexCopy.dstOffset;
+	vertexBarrier.size = vertexCopy.size;
+	transfer.buffers.push_back(vertexBarrier);
+
+	VkBufferMemoryBarrier2 indexBarrier = { .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+	indexBarrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT;
+	indexBarrier.dstAccessMask = VK_ACCESS_2_INDEX_READ_BIT;
+	indexBarrier.buffer = rangeIndexBuffer;
+	indexBarrier.offset = indexCopy.dstOffset;
+	indexBarrier.size = indexCopy.size;
+	transfer.buffers.push_back(indexBarrier);
+}
+
+//Called once the graphics queue owns the uploaded data
+void GeometryArena::markResident(uint32_t handle, uint32_t generation)
+{
+	GeometryRange& range = ranges[handle];
+
+	if (range.live && range.generation == generation)
+	{
+		range.resident = true;
+	}
+}
+
+void GeometryArena::free(uint32_t handle)
+{
+	GeometryRange& range = ranges[handle];
+
+	vertexAllocator.free(range.vertexOffset, range.vertexCount);
+	getIndexAllocator(range.indexType).free(range.firstIndex, range.indexCount);
+
+	range.live = false;
+	freeHandles.push_back(handle);
+}
+
+//Worth compacting once the holes left by freed meshes outweigh the space in use
+bool GeometryArena::isFragmented()
+{
+	return vertexAllocator.getHoleSpace() > vertexAllocator.getUsed() || indexAllocator.getHoleSpace() > indexAllocator.getUsed() || shortIndexAllocator.getHoleSpace() > shortIndexAllocator.getUsed();
+}
+
+//Pack every live mesh into fresh buffers to close the holes. The GPU must not be using the old buffers.
+void GeometryArena::compact(VkDevice device, VkCommandPool commandPool, VkQueue queue)
+{
+	AllocatedBuffer newVertexBuffer;
+	AllocatedBuffer newIndexBuffer;
+	AllocatedBuffer newShortIndexBuffer;
+	createBuffers(newVertexBuffer, newIndexBuffer, newShortIndexBuffer);
+
+	std::vector<VkBufferCopy> vertexCopies;
+	std::vector<VkBufferCopy> indexCopies;
+	std::vector<VkBufferCopy> shortIndexCopies;
+
+	uint32_t vertexEnd = 0;
+	uint32_t indexEnd = 0;
+	uint32_t shortIndexEnd = 0;
+
+	for (GeometryRange& range : ranges)
+	{
+		if (!range.live)
+		{
+			continue;
+		}
+
+		bool shortIndices = range.indexType == VK_INDEX_TYPE_UINT16;
+		uint32_t& rangeIndexEnd = shortIndices ? shortIndexEnd : indexEnd;
+		VkDeviceSize indexSize = getIndexSize(range.indexType);
+
+		//Meshes whose upload has not landed only need new offsets, their data is copied later
+		if (range.resident)
+		{
+			vertexCopies.push_back({ (VkDeviceSize)vertexStride * range.vertexOffset, (VkDeviceSize)vertexStride * vertexEnd, (VkDeviceSize)vertexStride * range.vertexCount });
+			(shortIndices ? shortIndexCopies : indexCopies).push_back({ indexSize * range.firstIndex, indexSize * rangeIndexEnd, indexSize * range.indexCount });
+		}
+
+		range.vertexOffset = vertexEnd;
+		range.firstIndex = rangeIndexEnd;
+		vertexEnd += range.vertexCount;
+		rangeIndexEnd += range.indexCount;
+	}
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, commandPool);
+
+	if (!vertexCopies.empty())
+	{
+		vkCmdCopyBuffer(commandBuffer, vertexBuffer.buffer, newVertexBuffer.buffer, (uint32_t)vertexCopies.size(), vertexCopies.data());
+	}
+
+	if (!indexCopies.empty())
+	{
+		vkCmdCopyBuffer(commandBuffer, indexBuffer.buffer, newIndexBuffer.buffer, (uint32_t)indexCopies.size(), indexCopies.data());
+	}
+
+	if (!shortIndexCopies.empty())
+	{
+		vkCmdCopyBuffer(commandBuffer, shortIndexBuffer.buffer, newShortIndexBuffer.buffer, (uint32_t)shortIndexCopies.size(), shortIndexCopies.data());
+	}
+
+	endSingleTimeCommands(device, queue, commandPool, commandBuffer);
+
+	destroy();
+
+	vertexBuffer = newVertexBuffer;
+	indexBuffer = newIndexBuffer;
+	shortIndexBuffer = newShortIndexBuffer;
+
+	vertexAllocator.reset(vertexEnd);
+	indexAllocator.reset(indexEnd);
+	shortIndexAllocator.reset(shortIndexEnd);
+}
+
+void GeometryArena::destroy()
+{
+	vmaDestroyBuffer(allocator, vertexBuffer.buffer, vertexBuffer.allocation);
+	vmaDestroyBuffer(allocator, indexBuffer.buffer, indexBuffer.allocation);
+	vmaDestroyBuffer(allocator, shortIndexBuffer.buffer, shortIndexBuffer.allocation);
+}
\ No newline at end of file
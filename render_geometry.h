@@ -0,0 +1,88 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <map>
+
+#include "vk_mem_alloc.h"
+#include "render_types.h"
+#include "mesh.h"
+#include "render_upload.h"
+
+//Hands out ranges of a fixed size pool using first fit, merging neighbouring ranges when they are freed
+class RangeAllocator
+{
+public:
+	void init(uint32_t capacity);
+	bool allocate(uint32_t count, uint32_t& offset);
+	void free(uint32_t offset, uint32_t count);
+	void reset(uint32_t used);
+	uint32_t getUsed();
+	uint32_t getHoleSpace();
+
+private:
+	std::map<uint32_t, uint32_t> freeRanges;
+	uint32_t capacity;
+	uint32_t used;
+};
+
+//Location of one mesh inside the shared vertex and index buffers
+struct GeometryRange
+{
+	uint32_t vertexOffset;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	VkIndexType indexType;
+	uint32_t generation;
+	bool live;
+	bool resident;
+};
+
+//One large device local vertex buffer shared by every mesh, with one index buffer per index width.
+//Meshes small enough for 16 bit indices keep them in their own buffer, since an index buffer binding has a single index type.
+class GeometryArena
+{
+public:
+	void init(VmaAllocator allocator, uint32_t vertexStride, uint32_t maxVertices, uint32_t maxIndices);
+	uint32_t allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType);
+	void recordUpload(VkCommandBuffer commandBuffer, uint32_t handle, uint32_t generation, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, OwnershipTransfer& transfer);
+	void markResident(uint32_t handle, uint32_t generation);
+	void free(uint32_t handle);
+	bool isFragmented();
+	void compact(VkDevice device, VkCommandPool commandPool, VkQueue queue);
+	void destroy();
+
+	const GeometryRange& getRange(uint32_t handle)
+	{
+		return ranges[handle];
+	}
+
+	VkBuffer getVertexBuffer()
+	{
+		return vertexBuffer.buffer;
+	}
+
+	VkBuffer getIndexBuffer(VkIndexType indexType)
+	{
+		return indexType == VK_INDEX_TYPE_UINT16 ? shortIndexBuffer.buffer : indexBuffer.buffer;
+	}
+
+private:
+	VmaAllocator allocator;
+	uint32_t vertexStride;
+	uint32_t maxVertices;
+	uint32_t maxIndices;
+	AllocatedBuffer vertexBuffer;
+	AllocatedBuffer indexBuffer;
+	AllocatedBuffer shortIndexBuffer;
+
+	RangeAllocator vertexAllocator;
+	RangeAllocator indexAllocator;
+	RangeAllocator shortIndexAllocator;
+
+	std::vector<GeometryRange> ranges;
+	std::vector<uint32_t> freeHandles;
+
+	void createBuffers(AllocatedBuffer& vertices, AllocatedBuffer& indices, AllocatedBuffer& shortIndices);
+	RangeAllocator& getIndexAllocator(VkIndexType indexType);
+};
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include <vulkan/vulkan.h>
+#include <algorithm>
+
+#include "render_queue.h"
+
+constexpr uint32_t RADIX_BITS = 8;
+constexpr uint32_t RADIX_BUCKETS = 1 << RADIX_BITS;
+
+//Depth is the distance along the view direction divided by the far plane, so nearer draws sort first
+uint64_t makeSortKey(uint32_t pipeline, bool shortIndices, uint32_t mesh, uint32_t lod, uint32_t texture, float depth)
+{
+	uint64_t depthBits = (uint64_t)(std::clamp(depth, 0.0f, 1.0f) * ((1 << SORT_KEY_DEPTH_BITS) - 1));
+
+	uint64_t key = (uint64_t)(pipeline & ((1 << SORT_KEY_PIPELINE_BITS) - 1));
+	key = (key << SORT_KEY_INDEX_WIDTH_BITS) | (shortIndices ? 1 : 0);
+	key = (key << SORT_KEY_MESH_BITS) | (mesh & ((1 << SORT_KEY_MESH_BITS) - 1));
+	key = (key << SORT_KEY_LOD_BITS) | (lod & ((1 << SORT_KEY_LOD_BITS) - 1));
+	key = (key << SORT_KEY_DEPTH_BITS) | depthBits;
+	key = (key << SORT_KEY_TEXTURE_BITS) | (texture & ((1 << SORT_KEY_TEXTURE_BITS) - 1));
+
+	return key;
+}
+
+uint32_t getSortKeyLod(uint64_t key)
+{
+	return (uint32_t)(key >> (SORT_KEY_DEPTH_BITS + SORT_KEY_TEXTURE_BITS)) & ((1 << SORT_KEY_LOD_BITS) - 1);
+}
+
+void RenderQueue::clear()
+{
+	entries.clear();
+}
+
+void RenderQueue::push(uint64_t key, uint32_t index)
+{
+	entries.push_back({ key, index });
+}
+
+//Stable sort one byte at a time from the least significant end.
+//Passes where every key has the same byte, such as the unused pipeline bits, are skipped.
+void RenderQueue::sort()
+{
+	scratch.resize(entries.size());
+
+	for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS)
+	{
+		uint32_t counts[RADIX_BUCKETS] = {};
+
+		for (const RenderQueueEntry& entry : entries)
+		{
+			counts[(entry.key >> shift) & (RADIX_BUCKETS - 1)]++;
+		}
+
+		if (counts[(entries.empty() ? 0 : (entries[0].key >> shift) & (RADIX_BUCKETS - 1))] == entries.size())
+		{
+			continue;
+		}
+
+		uint32_t offsets[RADIX_BUCKETS];
+		uint32_t total = 0;
+
+		for (uint32_t i = 0; i < RADIX_BUCKETS; i++)
+		{
+			offsets[i] = total;
+			total += counts[i];
+		}
+
+		for (const RenderQueueEntry& entry : entries)
+		{
+			scratch[offsets[(entry.key >> shift) & (RADIX_BUCKETS - 1)]++] = entry;
+		}
+
+		entries.swap(scratch);
+	}
+}
+
+BindCache::BindCache(VkCommandBuffer commandBuffer)
+{
+	this->commandBuffer = commandBuffer;
+}
+
+void BindCache::bindIndexBuffer(VkBuffer buffer, VkIndexType indexType)
+{
+	if (indexBuffer == buffer)
+	{
+		bindsSkipped++;
+		return;
+	}
+
+	vkCmdBindIndexBuffer(commandBuffer, buffer, 0, indexType);
+	indexBuffer = buffer;
+}
\ No newline at end of file
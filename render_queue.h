@@ -0,0 +1,66 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+
+//Sort key layout, most significant first: pipeline (7 bits), index width (1 bit), mesh (17 bits), LOD (3 bits), depth (24 bits), texture (12 bits).
+//Textures are bindless and never cause a bind, so they only break ties below depth and instances of a mesh LOD go front to back.
+//Index width sits above the mesh so each index buffer is bound once and its batches form one run.
+constexpr uint32_t SORT_KEY_TEXTURE_BITS = 12;
+constexpr uint32_t SORT_KEY_DEPTH_BITS = 24;
+constexpr uint32_t SORT_KEY_LOD_BITS = 3;
+constexpr uint32_t SORT_KEY_MESH_BITS = 17;
+constexpr uint32_t SORT_KEY_INDEX_WIDTH_BITS = 1;
+constexpr uint32_t SORT_KEY_PIPELINE_BITS = 7;
+
+uint64_t makeSortKey(uint32_t pipeline, bool shortIndices, uint32_t mesh, uint32_t lod, uint32_t texture, float depth);
+uint32_t getSortKeyLod(uint64_t key);
+
+struct RenderQueueEntry
+{
+	uint64_t key;
+	uint32_t index;
+};
+
+//Per-frame list of draws ordered by their sort keys with an LSD radix sort
+class RenderQueue
+{
+public:
+	void clear();
+	void push(uint64_t key, uint32_t index);
+	void sort();
+
+	const std::vector<RenderQueueEntry>& getEntries()
+	{
+		return entries;
+	}
+
+private:
+	std::vector<RenderQueueEntry> entries;
+	std::vector<RenderQueueEntry> scratch;
+};
+
+//Tracks the index buffer bound on a command buffer so repeated binds can be dropped.
+//The pipeline, descriptor sets and vertex buffer never change between draws and are bound once up front instead.
+class BindCache
+{
+public:
+	BindCache(VkCommandBuffer commandBuffer);
+
+	void bindIndexBuffer(VkBuffer buffer, VkIndexType indexType);
+
+	VkCommandBuffer getCommandBuffer()
+	{
+		return commandBuffer;
+	}
+
+	uint32_t getBindsSkipped()
+	{
+		return bindsSkipped;
+	}
+
+private:
+	VkCommandBuffer commandBuffer;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	uint32_t bindsSkipped = 0;
+};
\ No newline at end of file
@@ -7,14 +7,17 @@
 #include <deque>
 #include <functional>
 #include <array>
+#include <vector>
 
 #include "vk_mem_alloc.h"
 #include "render_alloc.h"
+#include "gpu_profiler.h"
 
 struct AllocatedBuffer
 {
     VkBuffer buffer;
     VmaAllocation allocation;
+    void* mappedData = nullptr;
 };
 
 struct AllocatedImage
@@ -43,34 +46,178 @@ struct DeletionQueue
 	}
 };
 
+//Deletions waiting on a timeline semaphore. Each runs once the GPU has reached the value it was queued with.
+//Values must be pushed in increasing order.
+struct TimelineDeletionQueue
+{
+	std::deque<std::pair<uint64_t, std::function<void()>>> deletors;
+
+	void push_function(uint64_t timelineValue, std::function<void()>&& function)
+	{
+		deletors.push_back({ timelineValue, function });
+	}
+
+	void flush(uint64_t completedValue)
+	{
+		while (!deletors.empty() && deletors.front().first <= completedValue)
+		{
+			deletors.front().second();
+			deletors.pop_front();
+		}
+	}
+};
+
 struct VertexInputDescription
 {
 	VkVertexInputBindingDescription bindingDescription;
 	std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions;
 };
 
+enum class DrawMode
+{
+	Direct,
+	Indirect
+};
+
+enum class CullMode
+{
+	None,
+	CPU,
+	GPU
+};
+
+struct RenderSettings
+{
+	DrawMode drawMode = DrawMode::Indirect;
+	CullMode cullMode = CullMode::GPU;
+
+	//Bytes of queued uploads handed to the transfer queue per frame
+	VkDeviceSize uploadBudget = 8 * 1024 * 1024;
+
+	//Threads recording draws into secondary command buffers, 1 records inline on the main thread
+	uint32_t recordThreads = 1;
+
+	//Sample textures through their mip chains, off pins sampling to the base level for comparison
+	bool textureMipmaps = true;
+
+	//Store vertices in the packed 20 byte layout. Only read by Renderer::init, the vertex layout cannot change afterwards.
+	bool packedVertices = false;
+
+	//Largest on screen error in pixels a LOD may introduce before a more detailed one is drawn
+	float lodPixelError = 1.0f;
+
+	//Two phase occlusion culling against a depth pyramid, only used with GPU culling
+	bool occlusionCulling = true;
+
+	//Frames the CPU may queue ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT. Fewer lowers latency, more smooths out CPU spikes.
+	uint32_t framesInFlight = 2;
+
+	//Load and save the pipeline cache on disk. Only read by Renderer::init, off measures a cold start.
+	bool pipelineCache = true;
+
+	//Render into an offscreen image with no surface or swapchain. Only read by Renderer::init.
+	bool headless = false;
+};
+
+struct RenderStats
+{
+	uint32_t visibleInstances = 0;
+	uint32_t triangles = 0;
+	uint32_t occludedInstances = 0;
+	float cullTime = 0.0f;
+	float recordTime = 0.0f;
+	float sortTime = 0.0f;
+	uint32_t bindsSkipped = 0;
+	float submitTime = 0.0f;
+	uint32_t instancesUpdated = 0;
+
+	//Set once by Renderer::init
+	float startupTime = 0.0f;
+	float pipelineTime = 0.0f;
+};
+
+//Per-thread state for recording secondary command buffers in parallel
+struct RecordContext
+{
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	DescriptorAllocator descriptorAllocator;
+};
+
 struct FrameData
 {
 	VkCommandPool commandPool;
 	VkCommandBuffer commandBuffer;
 	
 	VkSemaphore presentSemaphore, renderSemaphore;
-	VkFence renderFence;
+
+	//Frame timeline value signalled by this slot's last submission, its resources are free to reuse once it is reached
+	uint64_t timelineValue = 0;
+
+	GpuTimestampFrame timestamps;
 
 	AllocatedBuffer cameraBuffer;
-	AllocatedBuffer instanceBuffer;
+	//Instances changed this frame on their way to the renderer's instance buffer, and the entity drawn in each slot
+	AllocatedBuffer instanceStagingBuffer;
+	AllocatedBuffer drawOrderBuffer;
+	AllocatedBuffer indirectBuffer;
+	AllocatedBuffer indirectStagingBuffer;
+	AllocatedBuffer batchIndexBuffer;
+	AllocatedBuffer visibleBuffer;
+	AllocatedBuffer visibleStagingBuffer;
+	AllocatedBuffer lateIndirectBuffer;
+	AllocatedBuffer lateVisibleBuffer;
+	AllocatedBuffer cullStatsBuffer;
+	bool cullStatsWritten = false;
 
 	DescriptorAllocator descriptorAllocator;
+	std::vector<RecordContext> recordContexts;
+
+	//This frame's copy of the bindless texture table, and the textures that landed since it was last brought up to date
+	VkDescriptorSet textureSet;
+	std::vector<std::pair<uint32_t, VkImageView>> landedTextures;
 };
 
 struct Camera
 {
 	glm::mat4 view;
 	glm::mat4 proj;
+	glm::vec4 frustum[6];
+};
+
+//Indirect draw command followed by the batch's mesh bounds, matching DrawCommand in cull.comp
+struct GPUDrawCommand
+{
+	VkDrawIndexedIndirectCommand command;
+	uint32_t padding[3];
+	glm::vec4 boundingSphere;
+};
+
+//Push constants of cull.comp
+struct CullConstants
+{
+	uint32_t instanceCount;
+	uint32_t phase;
+	uint32_t screenWidth;
+	uint32_t screenHeight;
+	uint32_t pyramidLevels;
 };
 
 struct TextureImage
 {
 	AllocatedImage texture;
 	VkImageView textureView;
+	uint32_t index;
+};
+
+//Per instance data read by the vertex and cull shaders, matching InstanceData in shader.vert. 32 bytes against 80 for a full matrix.
+//Rotation is a unit quaternion in four snorm16s, scale is three halves and the texture index takes the top half of the last word.
+//Object id is stable across frames so occlusion culling can remember what was visible.
+struct InstanceData
+{
+	glm::vec3 position;
+	uint32_t objectId;
+	uint32_t rotation[2];
+	uint32_t scaleXY;
+	uint32_t scaleZTexture;
 };
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include "render_upload.h"
+#include "render_utils.h"
+#include "cpu_profiler.h"
+#include "vk_mem_alloc.h"
+
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void TransferUploader::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily, VkDeviceSize size)
+{
+	this->device = device;
+	this->allocator = allocator;
+	this->queue = queue;
+	this->queueFamily = queueFamily;
+	this->graphicsQueueFamily = graphicsQueueFamily;
+	this->size = size;
+
+	buffer = createBuffer(allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	mappedData = (uint8_t*)buffer.mappedData;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+
+	VkSemaphoreTypeCreateInfo timelineInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreInfo.pNext = &timelineInfo;
+
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload timeline semaphore!");
+	}
+}
+
+//Queue data to be copied into the ring on a later submit. complete runs once the graphics queue owns the result,
+//after finish has recorded any follow up work into the graphics command buffer.
+void TransferUploader::enqueue(std::vector<uint8_t>&& data, UploadRecorder&& record, std::function<void()>&& complete, UploadFinisher&& finish)
+{
+	if (data.size() > size)
+	{
+		throw std::runtime_error("Upload is larger than the staging ring");
+	}
+
+	pending.push_back({ std::move(data), std::move(record), std::move(complete), std::move(finish) });
+}
+
+//Reserve space at the write position, skipping to the start of the ring if the allocation would straddle its end
+bool TransferUploader::allocate(VkDeviceSize allocSize, VkDeviceSize& offset)
+{
+	allocSize = (allocSize + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+	VkDeviceSize start = writePosition % size;
+	VkDeviceSize padding = start + allocSize > size ? size - start : 0;
+
+	if (writePosition + padding + allocSize - readPosition > size)
+	{
+		return false;
+	}
+
+	writePosition += padding;
+	offset = writePosition % size;
+	writePosition += allocSize;
+
+	return true;
+}
+
+VkCommandBuffer TransferUploader::getCommandBuffer()
+{
+	if (!freeCommandBuffers.empty())
+	{
+		VkCommandBuffer commandBuffer = freeCommandBuffers.back();
+		freeCommandBuffers.pop_back();
+		return commandBuffer;
+	}
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	return commandBuffer;
+}
+
+//Copy queued uploads into the ring and submit them to the transfer queue until the byte budget or the ring runs out.
+//The first request always goes through so a single upload larger than the budget cannot stall forever.
+void TransferUploader::submit(VkDeviceSize budget)
+{
+	PROFILE_SCOPE("Upload submit");
+
+	UploadBatch batch = {};
+	VkDeviceSize flushed = 0;
+	bool recorded = false;
+
+	while (!pending.empty())
+	{
+		UploadRequest& request = pending.front();
+
+		if (recorded && flushed + request.data.size() > budget)
+		{
+			break;
+		}
+
+		VkDeviceSize offset;
+
+		if (!allocate(request.data.size(), offset))
+		{
+			break;
+		}
+
+		if (!recorded)
+		{
+			batch.commandBuffer = getCommandBuffer();
+
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+			vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+		}
+
+		memcpy(mappedData + offset, request.data.data(), request.data.size());
+		vmaFlushAllocation(allocator, buffer.allocation, offset, request.data.size());
+		request.record(batch.commandBuffer, buffer.buffer, offset, batch.transfer);
+		batch.completions.push_back(std::move(request.complete));
+
+		if (request.finish)
+		{
+			batch.finishers.push_back(std::move(request.finish));
+		}
+
+		flushed += request.data.size();
+		recorded = true;
+		pending.pop_front();
+	}
+
+	if (!recorded)
+	{
+		return;
+	}
+
+	//Release the copied resources to the graphics family. With a shared family only image layouts need changing,
+	//the semaphore wait on the graphics side already makes the writes visible.
+	bool separateFamily = queueFamily != graphicsQueueFamily;
+
+	std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+	std::vector<VkImageMemoryBarrier2> imageBarriers;
+
+	if (separateFamily)
+	{
+		for (VkBufferMemoryBarrier2 barrier : batch.transfer.buffers)
+		{
+			barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+			barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+			barrier.dstAccessMask = VK_ACCESS_2_NONE;
+			barrier.srcQueueFamilyIndex = queueFamily;
+			barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+			bufferBarriers.push_back(barrier);
+		}
+	}
+
+	for (VkImageMemoryBarrier2 barrier : batch.transfer.images)
+	{
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+		if (separateFamily)
+		{
+			barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+			barrier.dstAccessMask = VK_ACCESS_2_NONE;
+			barrier.srcQueueFamilyIndex = queueFamily;
+			barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+		}
+		else
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		}
+
+		imageBarriers.push_back(barrier);
+	}
+
+	if (!bufferBarriers.empty() || !imageBarriers.empty())
+	{
+		VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		depInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+		depInfo.pBufferMemoryBarriers = bufferBarriers.data();
+		depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+		depInfo.pImageMemoryBarriers = imageBarriers.data();
+
+		vkCmdPipelineBarrier2(batch.commandBuffer, &depInfo);
+	}
+
+	vkEndCommandBuffer(batch.commandBuffer);
+
+	batch.timelineValue = ++timelineValue;
+	batch.ringPosition = writePosition;
+
+	VkCommandBufferSubmitInfo commandInfo = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+	commandInfo.commandBuffer = batch.commandBuffer;
+
+	VkSemaphoreSubmitInfo signalInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+	signalInfo.semaphore = timeline;
+	signalInfo.value = batch.timelineValue;
+	signalInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo2 submitInfo = { .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+	submitInfo.commandBufferInfoCount = 1;
+	submitInfo.pCommandBufferInfos = &commandInfo;
+	submitInfo.signalSemaphoreInfoCount = 1;
+	submitInfo.pSignalSemaphoreInfos = &signalInfo;
+
+	if (vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit uploads!");
+	}
+
+	inFlight.push_back(std::move(batch));
+}
+
+//Take ownership of every batch the transfer queue has finished without waiting on the rest.
+//Returns the timeline value the graphics submission must wait on, or 0 if nothing was acquired.
+uint64_t TransferUploader::acquire(VkCommandBuffer graphicsCommandBuffer)
+{
+	uint64_t completedValue;
+	vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+
+	bool separateFamily = queueFamily != graphicsQueueFamily;
+	uint64_t acquiredValue = 0;
+
+	std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+	std::vector<VkImageMemoryBarrier2> imageBarriers;
+	std::vector<UploadFinisher> finishers;
+	std::vector<std::function<void()>> completions;
+
+	while (!inFlight.empty() && inFlight.front().timelineValue <= completedValue)
+	{
+		UploadBatch& batch = inFlight.front();
+
+		if (separateFamily)
+		{
+			for (VkBufferMemoryBarrier2 barrier : batch.transfer.buffers)
+			{
+				barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+				barrier.srcAccessMask = VK_ACCESS_2_NONE;
+				barrier.srcQueueFamilyIndex = queueFamily;
+				barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+				bufferBarriers.push_back(barrier);
+			}
+
+			for (VkImageMemoryBarrier2 barrier : batch.transfer.images)
+			{
+				barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+				barrier.srcAccessMask = VK_ACCESS_2_NONE;
+				barrier.srcQueueFamilyIndex = queueFamily;
+				barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+				imageBarriers.push_back(barrier);
+			}
+		}
+
+		std::move(batch.finishers.begin(), batch.finishers.end(), std::back_inserter(finishers));
+		std::move(batch.completions.begin(), batch.completions.end(), std::back_inserter(completions));
+
+		readPosition = batch.ringPosition;
+		acquiredValue = batch.timelineValue;
+		freeCommandBuffers.push_back(batch.commandBuffer);
+		inFlight.pop_front();
+	}
+
+	if (!bufferBarriers.empty() || !imageBarriers.empty())
+	{
+		VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		depInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+		depInfo.pBufferMemoryBarriers = bufferBarriers.data();
+		depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+		depInfo.pImageMemoryBarriers = imageBarriers.data();
+
+		vkCmdPipelineBarrier2(graphicsCommandBuffer, &depInfo);
+	}
+
+	for (UploadFinisher& finish : finishers)
+	{
+		finish(graphicsCommandBuffer);
+	}
+
+	for (std::function<void()>& complete : completions)
+	{
+		complete();
+	}
+
+	return acquiredValue;
+}
+
+bool TransferUploader::hasPending()
+{
+	return !pending.empty() || !inFlight.empty();
+}
+
+void TransferUploader::destroy()
+{
+	vkDestroySemaphore(device, timeline, nullptr);
+	vkDestroyCommandPool(device, commandPool, nullptr);
+
+	vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <functional>
+
+#include "vk_mem_alloc.h"
+#include "render_types.h"
+
+//Barriers describing the state a request's resources must be in once the graphics queue owns them.
+//Queue families and source masks are filled in by the uploader.
+struct OwnershipTransfer
+{
+	std::vector<VkBufferMemoryBarrier2> buffers;
+	std::vector<VkImageMemoryBarrier2> images;
+};
+
+//Records the copy out of the staging buffer once a request's data has been placed in the ring
+using UploadRecorder = std::function<void(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, OwnershipTransfer& transfer)>;
+
+//Records graphics queue work on an upload once it has been acquired, such as blits the transfer queue cannot do
+using UploadFinisher = std::function<void(VkCommandBuffer commandBuffer)>;
+
+struct UploadRequest
+{
+	std::vector<uint8_t> data;
+	UploadRecorder record;
+	std::function<void()> complete;
+	UploadFinisher finish;
+};
+
+//One submission to the transfer queue, retired when the timeline semaphore reaches its value
+struct UploadBatch
+{
+	uint64_t timelineValue;
+	uint64_t ringPosition;
+	VkCommandBuffer commandBuffer;
+	OwnershipTransfer transfer;
+	std::vector<std::function<void()>> completions;
+	std::vector<UploadFinisher> finishers;
+};
+
+//Copies queued uploads through a persistently mapped ring buffer on the transfer queue while rendering continues.
+//Ring positions only ever increase, so a finished batch retires its share of the ring by handing back the position it reached.
+class TransferUploader
+{
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily, VkDeviceSize size);
+	void enqueue(std::vector<uint8_t>&& data, UploadRecorder&& record, std::function<void()>&& complete, UploadFinisher&& finish = nullptr);
+	void submit(VkDeviceSize budget);
+	uint64_t acquire(VkCommandBuffer graphicsCommandBuffer);
+	bool hasPending();
+	void destroy();
+
+	VkSemaphore getSemaphore()
+	{
+		return timeline;
+	}
+
+private:
+	VkDevice device;
+	VmaAllocator allocator;
+	VkQueue queue;
+	uint32_t queueFamily;
+	uint32_t graphicsQueueFamily;
+
+	VkCommandPool commandPool;
+	std::vector<VkCommandBuffer> freeCommandBuffers;
+	VkSemaphore timeline;
+	uint64_t timelineValue = 0;
+
+	AllocatedBuffer buffer;
+	uint8_t* mappedData;
+	VkDeviceSize size;
+
+	uint64_t writePosition = 0;
+	uint64_t readPosition = 0;
+
+	std::deque<UploadRequest> pending;
+	std::deque<UploadBatch> inFlight;
+
+	bool allocate(VkDeviceSize allocSize, VkDeviceSize& offset);
+	VkCommandBuffer getCommandBuffer();
+};
\ No newline at end of file
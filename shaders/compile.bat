@@ -1,3 +1,9 @@
 C:\VulkanSDK\1.3.261.1\Bin\glslc.exe shader.vert -o vert.spv
 C:\VulkanSDK\1.3.261.1\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe depthreduce.comp -o depthreduce.spv
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe -mfmt=c shader.vert -o vert.spv.inc
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe -mfmt=c shader.frag -o frag.spv.inc
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe -mfmt=c cull.comp -o cull.spv.inc
+C:\VulkanSDK\1.3.261.1\Bin\glslc.exe -mfmt=c depthreduce.comp -o depthreduce.spv.inc
 pause
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+//SPIR-V compiled into the executable when SLOPE_EMBED_SHADERS is defined.
+//The .inc files are glslc's C initializer output, generated by the pre-build step and compile.bat.
+constexpr uint32_t VERT_SPIRV[] =
+#include "vert.spv.inc"
+;
+
+constexpr uint32_t FRAG_SPIRV[] =
+#include "frag.spv.inc"
+;
+
+constexpr uint32_t CULL_SPIRV[] =
+#include "cull.spv.inc"
+;
+
+constexpr uint32_t DEPTH_REDUCE_SPIRV[] =
+#include "depthreduce.spv.inc"
+;
+
+//Looked up by the path the shader would otherwise be loaded from
+struct EmbeddedShader
+{
+	const char* path;
+	const uint32_t* code;
+	size_t size;
+};
+
+constexpr EmbeddedShader EMBEDDED_SHADERS[] =
+{
+	{ "shaders/vert.spv", VERT_SPIRV, sizeof(VERT_SPIRV) },
+	{ "shaders/frag.spv", FRAG_SPIRV, sizeof(FRAG_SPIRV) },
+	{ "shaders/cull.spv", CULL_SPIRV, sizeof(CULL_SPIRV) },
+	{ "shaders/depthreduce.spv", DEPTH_REDUCE_SPIRV, sizeof(DEPTH_REDUCE_SPIRV) }
+};
\ No newline at end of file
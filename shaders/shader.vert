@@ -1,16 +1,35 @@
 #version 460
 
+//Set when the vertex buffer holds packed vertices. Positions then arrive normalized and the instance transform carries the dequantize transform.
+layout(constant_id = 0) const bool packedVertices = false;
+
 layout(binding = 0) uniform Camera
 {
     mat4 view;
     mat4 proj;
+    vec4 frustum[6];
 } camera;
 
-layout(std140,binding = 1) readonly buffer InstanceBuffer
+//Matches InstanceData in render_types.h
+struct InstanceData
+{
+    vec3 position;
+    uint objectId;
+    uvec2 rotation;
+    uint scaleXY;
+    uint scaleZTexture;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer
 {
-    mat4 instances[];
+    InstanceData instances[];
 } instanceBuffer;
 
+layout(std430, binding = 2) readonly buffer VisibleBuffer
+{
+    uint visibleInstances[];
+} visibleBuffer;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
@@ -19,12 +38,33 @@ layout(location = 3) in vec3 inNormal;
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragNormal;
+layout(location = 3) flat out uint fragTextureIndex;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
+
+vec3 rotateByQuaternion(vec4 rotation, vec3 vector)
+{
+    return vector + 2.0 * cross(rotation.xyz, cross(rotation.xyz, vector) + rotation.w * vector);
+}
 
 void main()
 {
-    mat4 model = instanceBuffer.instances[gl_BaseInstance];
-    gl_Position = camera.proj * camera.view * model * vec4(inPosition, 1.0);
+    InstanceData instance = instanceBuffer.instances[visibleBuffer.visibleInstances[gl_InstanceIndex]];
+    vec4 rotation = normalize(vec4(unpackSnorm2x16(instance.rotation.x), unpackSnorm2x16(instance.rotation.y)));
+    vec3 scale = vec3(unpackHalf2x16(instance.scaleXY), unpackHalf2x16(instance.scaleZTexture).x);
+
+    vec3 worldPosition = instance.position + rotateByQuaternion(rotation, scale * inPosition);
+    gl_Position = camera.proj * camera.view * vec4(worldPosition, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
-    fragNormal = (model * vec4(inNormal, 0.0)).xyz;
+    vec3 normal = packedVertices ? decodeOctahedral(inNormal.xy) : inNormal;
+    fragNormal = normalize(rotateByQuaternion(rotation, normal / scale));
+    fragTextureIndex = instance.scaleZTexture >> 16;
 }
\ No newline at end of file
@@ -3,4 +3,5 @@
 void Spinner::tick(float delta)
 {
 	transform.rotation.y += delta * 90;
+	markTransformDirty();
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "worker_pool.h"
+
+void WorkerPool::init(uint32_t threadCount)
+{
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+//Run job(0) to job(jobCount - 1) across the workers and return once every job has finished
+void WorkerPool::run(uint32_t jobCount, const std::function<void(uint32_t)>& job)
+{
+	if (jobCount == 0)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	currentJob = &job;
+	this->jobCount = jobCount;
+	nextJob = 0;
+	jobsRemaining = jobCount;
+	dispatch++;
+
+	workReady.notify_all();
+	workDone.wait(lock, [&]() { return jobsRemaining == 0; });
+
+	currentJob = nullptr;
+}
+
+void WorkerPool::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	workReady.notify_all();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	threads.clear();
+}
+
+void WorkerPool::workerLoop()
+{
+	uint64_t seenDispatch = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		workReady.wait(lock, [&]() { return stopping || (dispatch != seenDispatch && nextJob < jobCount); });
+
+		if (stopping)
+		{
+			return;
+		}
+
+		//Keep taking jobs from this dispatch until none are left
+		while (nextJob < jobCount)
+		{
+			uint32_t jobIndex = nextJob++;
+			const std::function<void(uint32_t)>& job = *currentJob;
+
+			lock.unlock();
+			job(jobIndex);
+			lock.lock();
+
+			if (--jobsRemaining == 0)
+			{
+				workDone.notify_one();
+			}
+		}
+
+		seenDispatch = dispatch;
+	}
+}
\ No newline at end of file
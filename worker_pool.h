@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+//Fixed set of threads that run one indexed job each per dispatch while the caller waits
+class WorkerPool
+{
+public:
+	void init(uint32_t threadCount);
+	void run(uint32_t jobCount, const std::function<void(uint32_t)>& job);
+	void shutdown();
+
+	uint32_t getThreadCount()
+	{
+		return (uint32_t)threads.size();
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+
+	const std::function<void(uint32_t)>* currentJob = nullptr;
+	uint32_t jobCount = 0;
+	uint32_t nextJob = 0;
+	uint32_t jobsRemaining = 0;
+	uint64_t dispatch = 0;
+	bool stopping = false;
+
+	void workerLoop();
+};
\ No newline at end of file